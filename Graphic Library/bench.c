@@ -0,0 +1,300 @@
+/**
+ * File: bench.c
+ * Author: Quan Nguyen
+ * Project: Graphic Library
+ * Class: CSC252
+ * Purpose: This is the benchmark for the shadow buffers. It runs the same column heavy
+ * drawing (vertical lines over the whole screen, then a walk down every column reading and
+ * writing each pixel) on a buffer from create_buffer() and on buffers from
+ * create_shadow_buffer() with padded rows and huge pages, and prints the time of each
+ * together with the time of blit(). It then times shade_triangle() in shaded pixels per
+ * second and checks that two triangles sharing an edge never draw the same pixel. Last it
+ * times every conversion on a 3840x2160 frame and checks the vectorized conversions against
+ * a one pixel at a time reference, dither included. It reads
+ * the screen size from the library globals, so it includes library.h. Press any key to leave
+ * once it is done.
+ */
+#include "library.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#define ROUNDS 20
+// side of the cells of the small triangle grid
+#define CELL 16
+// corners of the shared edge triangles stay in a SPAN x SPAN square
+#define SPAN 48
+#define PAIRS 2000
+// size of the frame for the conversion timings
+#define FRAME_W 3840
+#define FRAME_H 2160
+// the conversion check runs every row length up to this, so all the tails come up
+#define CHECK_W 80
+/**
+ * Get the time right now in milliseconds.
+ */
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+/**
+ * Draw every column of the screen as a vertical line.
+ */
+void column_lines(void *buf, int width, int height) {
+    int x;
+    for (x = 0; x < width; x++) {
+        draw_line(buf, x, 0, x, height - 1, RGB(x & 31, 0, 31));
+    }
+}
+/**
+ * Walk down every column, making each pixel a mix of itself and the one above it.
+ */
+void column_walk(void *buf, int width, int height) {
+    color_t *img = (color_t *)buf;
+    int pitch = buffer_pitch(buf);
+    int x, y;
+    for (x = 0; x < width; x++) {
+        for (y = 1; y < height; y++) {
+            img[y * pitch + x] = (color_t)((img[y * pitch + x] >> 1) + (img[(y - 1) * pitch + x] >> 1));
+        }
+    }
+}
+/**
+ * Time both workloads and blit() on one buffer, print the results and give the buffer back.
+ */
+void run(const char *name, void *buf, int width, int height) {
+    int i;
+    double start, lines, walk, copy;
+    if (buf == NULL) {
+        printf("%-24s could not be created\n", name);
+        return;
+    }
+    clear_screen(buf);
+    start = now_ms();
+    for (i = 0; i < ROUNDS; i++) {
+        column_lines(buf, width, height);
+    }
+    lines = (now_ms() - start) / ROUNDS;
+    start = now_ms();
+    for (i = 0; i < ROUNDS; i++) {
+        column_walk(buf, width, height);
+    }
+    walk = (now_ms() - start) / ROUNDS;
+    start = now_ms();
+    for (i = 0; i < ROUNDS; i++) {
+        blit(buf);
+    }
+    copy = (now_ms() - start) / ROUNDS;
+    printf("%-24s pitch %5d  lines %8.3f ms  walk %8.3f ms  blit %8.3f ms\n",
+           name, buffer_pitch(buf), lines, walk, copy);
+    destroy_buffer(buf);
+}
+/**
+ * Cover the first w x h pixels of buf with shaded triangles, two for each cell x cell square.
+ * Thanks to the top-left rule every pixel is drawn exactly once.
+ */
+void shade_grid(void *buf, int w, int h, int cell) {
+    int x, y;
+    for (y = 0; y < h; y += cell) {
+        for (x = 0; x < w; x += cell) {
+            shade_triangle(buf, x, y, RGB(31, 0, 0), x + cell, y, RGB(0, 63, 0), x, y + cell, RGB(0, 0, 31));
+            shade_triangle(buf, x + cell, y, RGB(0, 63, 0), x + cell, y + cell, RGB(31, 63, 31),
+                           x, y + cell, RGB(0, 0, 31));
+        }
+    }
+}
+/**
+ * Time shade_triangle() with two triangles over the whole screen and with a grid of small
+ * ones, and print how many shaded pixels it draws per second.
+ */
+void triangles(int width, int height) {
+    void *buf = create_buffer();
+    int i, cells[2] = {0, CELL};
+    const char *names[2] = {"shade_triangle screen", "shade_triangle 16x16"};
+    for (i = 0; i < 2; i++) {
+        int w = cells[i] ? width - width % cells[i] : width;
+        int h = cells[i] ? height - height % cells[i] : height;
+        int r;
+        double start = now_ms();
+        for (r = 0; r < ROUNDS; r++) {
+            shade_grid(buf, w, h, cells[i] ? cells[i] : (w > h ? w : h));
+        }
+        double ms = (now_ms() - start) / ROUNDS;
+        printf("%-24s %8.3f ms  %8.1f Mpixels/s\n", names[i], ms, (double)w * h / ms / 1000.0);
+    }
+    destroy_buffer(buf);
+}
+/**
+ * Fill a random pair of triangles sharing an edge into two zeroed buffers and count the
+ * pixels both of them drew. Many corners land on the same row or column, so flat and
+ * upright shared edges (where the top-left rule decides) come up often.
+ */
+int shared_edge(color_t *a, color_t *b, int pitch) {
+    int px = rand() % SPAN, py = rand() % SPAN, qx = rand() % SPAN, qy = rand() % SPAN;
+    int rx = rand() % SPAN, ry = rand() % SPAN, sx = rand() % SPAN, sy = rand() % SPAN;
+    long side1 = (long)(qx - px) * (ry - py) - (long)(qy - py) * (rx - px);
+    long side2 = (long)(qx - px) * (sy - py) - (long)(qy - py) * (sx - px);
+    int x, y, twice = 0;
+    if (side1 == 0 || side2 == 0 || (side1 > 0) == (side2 > 0)) {
+        return 0; // both on the same side of the edge, or flat
+    }
+    for (y = 0; y < SPAN; y++) {
+        for (x = 0; x < SPAN; x++) {
+            a[y * pitch + x] = b[y * pitch + x] = 0;
+        }
+    }
+    fill_triangle(a, px, py, qx, qy, rx, ry, RGB(31, 63, 31));
+    fill_triangle(b, qx, qy, px, py, sx, sy, RGB(31, 63, 31));
+    for (y = 0; y < SPAN; y++) {
+        for (x = 0; x < SPAN; x++) {
+            twice += a[y * pitch + x] && b[y * pitch + x];
+        }
+    }
+    return twice;
+}
+/**
+ * Check PAIRS random triangle pairs for pixels drawn by both triangles.
+ */
+void shared_edges() {
+    void *a = create_buffer(), *b = create_buffer();
+    int i, twice = 0, bad = 0;
+    srand(452);
+    for (i = 0; i < PAIRS; i++) {
+        int n = shared_edge((color_t *)a, (color_t *)b, buffer_pitch(a));
+        twice += n;
+        bad += n != 0;
+    }
+    printf("%-24s %s (%d of %d pairs, %d pixels drawn twice)\n", "shared edges",
+           bad ? "FAILED" : "ok", bad, PAIRS, twice);
+    destroy_buffer(a);
+    destroy_buffer(b);
+}
+/**
+ * Reference conversion of one 8 bit pixel at (x, y) to color_t, written the plain way.
+ */
+color_t ref_to_565(int r, int g, int b, int x, int y, int dither) {
+    static const int bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+    if (dither) {
+        int d = bayer[y & 3][x & 3];
+        r = r + d / 2 > 255 ? 255 : r + d / 2;
+        g = g + d / 4 > 255 ? 255 : g + d / 4;
+        b = b + d / 2 > 255 ? 255 : b + d / 2;
+    }
+    return (color_t)((r >> 3) << 11 | (g >> 2) << 5 | b >> 3);
+}
+/**
+ * Reference conversion of one color_t channel of the given number of bits back to 8 bits.
+ */
+int ref_to_8(int v, int bits) {
+    return v << (8 - bits) | v >> (2 * bits - 8);
+}
+/**
+ * Convert random images of every row length up to CHECK_W and 4 rows (one for each dither
+ * row) both ways, and count the pixels that differ from the reference.
+ */
+void check_convert() {
+    static unsigned char rgb[4][3 * CHECK_W], rgbBack[4][3 * CHECK_W];
+    static unsigned int argb[4][CHECK_W], argbBack[4][CHECK_W];
+    static color_t out[4][CHECK_W], in[4][CHECK_W];
+    int w, x, y, dither, bad = 0;
+    srand(252);
+    for (w = 1; w <= CHECK_W; w++) {
+        for (y = 0; y < 4; y++) {
+            for (x = 0; x < w; x++) {
+                // many channels near 255 to hit the clamp of the dither
+                argb[y][x] = (unsigned int)rand() | (rand() & 1 ? 0xf0f0f0u : 0);
+                rgb[y][3 * x] = (unsigned char)(argb[y][x] >> 16);
+                rgb[y][3 * x + 1] = (unsigned char)(argb[y][x] >> 8);
+                rgb[y][3 * x + 2] = (unsigned char)argb[y][x];
+                in[y][x] = (color_t)rand();
+            }
+        }
+        for (dither = 0; dither <= CONVERT_DITHER; dither += CONVERT_DITHER) {
+            convert_to_screen(out, sizeof(out[0]), argb, sizeof(argb[0]), w, 4, PIXEL_ARGB8888, dither);
+            for (y = 0; y < 4; y++) {
+                for (x = 0; x < w; x++) {
+                    bad += out[y][x] != ref_to_565(argb[y][x] >> 16 & 0xff, argb[y][x] >> 8 & 0xff,
+                                                   argb[y][x] & 0xff, x, y, dither);
+                }
+            }
+            convert_to_screen(out, sizeof(out[0]), rgb, sizeof(rgb[0]), w, 4, PIXEL_RGB888, dither);
+            for (y = 0; y < 4; y++) {
+                for (x = 0; x < w; x++) {
+                    bad += out[y][x] != ref_to_565(rgb[y][3 * x], rgb[y][3 * x + 1], rgb[y][3 * x + 2], x, y, dither);
+                }
+            }
+        }
+        convert_from_screen(argbBack, sizeof(argbBack[0]), in, sizeof(in[0]), w, 4, PIXEL_ARGB8888);
+        convert_from_screen(rgbBack, sizeof(rgbBack[0]), in, sizeof(in[0]), w, 4, PIXEL_RGB888);
+        for (y = 0; y < 4; y++) {
+            for (x = 0; x < w; x++) {
+                int r = ref_to_8(in[y][x] >> 11, 5), g = ref_to_8(in[y][x] >> 5 & 0x3f, 6);
+                int b = ref_to_8(in[y][x] & 0x1f, 5);
+                bad += argbBack[y][x] != (0xff000000u | (unsigned int)(r << 16 | g << 8 | b));
+                bad += rgbBack[y][3 * x] != r || rgbBack[y][3 * x + 1] != g || rgbBack[y][3 * x + 2] != b;
+            }
+            // nothing may be written past the row
+            for (x = w; x < CHECK_W; x++) {
+                bad += rgbBack[y][3 * x] || rgbBack[y][3 * x + 1] || rgbBack[y][3 * x + 2] || argbBack[y][x];
+            }
+        }
+    }
+    printf("%-24s %s (%d pixels differ from the reference)\n", "conversions", bad ? "FAILED" : "ok", bad);
+}
+/**
+ * Time every conversion on one FRAME_W x FRAME_H frame and print the time of one frame.
+ */
+void convert_frame() {
+    unsigned char *rgb = malloc(3L * FRAME_W * FRAME_H);
+    unsigned int *argb = malloc(4L * FRAME_W * FRAME_H);
+    color_t *out = malloc(2L * FRAME_W * FRAME_H);
+    const char *names[6] = {"RGB888 to screen", "RGB888 dither", "ARGB8888 to screen",
+                            "ARGB8888 dither", "screen to RGB888", "screen to ARGB8888"};
+    const int formats[6] = {PIXEL_RGB888, PIXEL_RGB888, PIXEL_ARGB8888, PIXEL_ARGB8888,
+                            PIXEL_RGB888, PIXEL_ARGB8888};
+    long i;
+    int k, r;
+    if (rgb == NULL || argb == NULL || out == NULL) {
+        printf("%-24s could not allocate the frame\n", "conversions");
+        goto out;
+    }
+    for (i = 0; i < (long)FRAME_W * FRAME_H; i++) {
+        argb[i] = (unsigned int)(i * 2654435761u);
+        rgb[3 * i] = rgb[3 * i + 1] = rgb[3 * i + 2] = (unsigned char)i;
+        out[i] = (color_t)i;
+    }
+    for (k = 0; k < 6; k++) {
+        int format = formats[k];
+        void *image = format == PIXEL_ARGB8888 ? (void *)argb : (void *)rgb;
+        int pitch = format == PIXEL_ARGB8888 ? 4 * FRAME_W : 3 * FRAME_W;
+        double start = now_ms();
+        for (r = 0; r < ROUNDS; r++) {
+            if (k < 4) {
+                convert_to_screen(out, 2 * FRAME_W, image, pitch, FRAME_W, FRAME_H, format, k % 2 ? CONVERT_DITHER : 0);
+            } else {
+                convert_from_screen(image, pitch, out, 2 * FRAME_W, FRAME_W, FRAME_H, format);
+            }
+        }
+        printf("%-24s %dx%d  %8.3f ms\n", names[k], FRAME_W, FRAME_H, (now_ms() - start) / ROUNDS);
+    }
+out:
+    free(rgb);
+    free(argb);
+    free(out);
+}
+int main(void)
+{
+    init_graphics();
+    int width = bitDepth / 2;
+    run("create_buffer", create_buffer(), width, yLength);
+    run("padded", create_shadow_buffer(BUFFER_PADDED), width, yLength);
+    run("hugepage", create_shadow_buffer(BUFFER_HUGEPAGE), width, yLength);
+    run("padded + hugepage", create_shadow_buffer(BUFFER_PADDED | BUFFER_HUGEPAGE), width, yLength);
+    triangles(width, yLength);
+    shared_edges();
+    convert_frame();
+    check_convert();
+    getkey();
+    exit_graphics();
+    return 0;
+}
@@ -0,0 +1,394 @@
+/**
+ * File: capture.c
+ * Author: Quan Nguyen
+ * Project: Graphic Library
+ * Class: CSC252
+ * Purpose: This is the screenshot part of the library. capture_screen() copies what the
+ * frameBuffer is showing into one buffer of a small pool with a streaming copy and hands it
+ * to a background thread, which converts it with convert_from_screen() and writes a PPM or
+ * PNG file. The caller never waits for the encoding: when every pooled buffer is still
+ * waiting to be written the capture is dropped instead. The first capture registers
+ * capture_flush() with atexit(), so screenshots still being written are finished before the
+ * program ends; the rest of the library does not depend on this file. Programs using this
+ * part have to link with -pthread.
+ */
+#include "library.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+// number of screenshots that can wait for the encoder at the same time
+#define CAPTURE_POOL 4
+#define CAPTURE_PATH 256
+// widest screen the encoder handles (one row of RGB888 plus the PNG filter byte)
+#define CAPTURE_MAX_WIDTH 8192
+// biggest stored deflate block
+#define BLOCK_MAX 65535
+/**
+ * One buffer of the pool and the request that goes with it.
+ */
+typedef struct Capture {
+    color_t *pixels;
+    char path[CAPTURE_PATH];
+    int format;
+    int state;          // FREE, FILLING or QUEUED
+} Capture;
+enum { FREE, FILLING, QUEUED };
+static Capture pool[CAPTURE_POOL];
+// the queued captures in the order they were taken
+static int queue[CAPTURE_POOL];
+static int queueHead, queueCount;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static pthread_t encoder;
+static int started, stopping, registered;
+/**
+ * Copy bytes from the frameBuffer. The frameBuffer is usually write combining memory, so
+ * with SSE4.1 it is read with streaming loads, and the copy is written with non temporal
+ * stores so it does not push the caller's own data out of the cache.
+ */
+static void stream_copy(void *dst, const void *src, int bytes) {
+    int i = 0;
+    char *d = (char *)dst;
+    const char *s = (const char *)src;
+#if defined(__SSE2__)
+    if ((((unsigned long)d | (unsigned long)s) & 15) == 0) {
+        for (; i + 64 <= bytes; i += 64) {
+#if defined(__SSE4_1__)
+            __m128i a = _mm_stream_load_si128((__m128i *)(s + i));
+            __m128i b = _mm_stream_load_si128((__m128i *)(s + i + 16));
+            __m128i c = _mm_stream_load_si128((__m128i *)(s + i + 32));
+            __m128i e = _mm_stream_load_si128((__m128i *)(s + i + 48));
+#else
+            __m128i a = _mm_load_si128((const __m128i *)(s + i));
+            __m128i b = _mm_load_si128((const __m128i *)(s + i + 16));
+            __m128i c = _mm_load_si128((const __m128i *)(s + i + 32));
+            __m128i e = _mm_load_si128((const __m128i *)(s + i + 48));
+#endif
+            _mm_stream_si128((__m128i *)(d + i), a);
+            _mm_stream_si128((__m128i *)(d + i + 16), b);
+            _mm_stream_si128((__m128i *)(d + i + 32), c);
+            _mm_stream_si128((__m128i *)(d + i + 48), e);
+        }
+        _mm_sfence();
+    }
+#endif
+    for (; i < bytes; i++) {
+        d[i] = s[i];
+    }
+}
+/**
+ * Write the whole buffer to fd, going on after short writes.
+ */
+static int write_all(int fd, const void *buf, long n) {
+    const char *p = (const char *)buf;
+    while (n > 0) {
+        long done = write(fd, p, n);
+        if (done <= 0) {
+            return -1;
+        }
+        p += done;
+        n -= done;
+    }
+    return 0;
+}
+/**
+ * Write the pixels as a binary PPM (P6) file.
+ */
+static int write_ppm(int fd, const color_t *pixels, int width, int height, int pitch) {
+    static unsigned char row[3 * CAPTURE_MAX_WIDTH];
+    char header[64];
+    int y, n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    if (write_all(fd, header, n) < 0) {
+        return -1;
+    }
+    for (y = 0; y < height; y++) {
+        convert_from_screen(row, 3 * width, (const char *)pixels + (long)y * pitch, pitch,
+                            width, 1, PIXEL_RGB888);
+        if (write_all(fd, row, 3L * width) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+static unsigned int crcTable[256];
+/**
+ * Update a PNG CRC-32 with n more bytes.
+ */
+static unsigned int crc32(unsigned int crc, const unsigned char *p, long n) {
+    long i;
+    if (crcTable[1] == 0) {
+        unsigned int c, k, j;
+        for (k = 0; k < 256; k++) {
+            c = k;
+            for (j = 0; j < 8; j++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            crcTable[k] = c;
+        }
+    }
+    crc = ~crc;
+    for (i = 0; i < n; i++) {
+        crc = crcTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+/**
+ * Store a 32 bit number in network (big endian) order.
+ */
+static void put_be32(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+/**
+ * Write one PNG chunk: length, type, data and the CRC of type and data.
+ */
+static int write_chunk(int fd, const char *type, const unsigned char *data, long n) {
+    unsigned char head[8], tail[4];
+    put_be32(head, (unsigned int)n);
+    head[4] = type[0];
+    head[5] = type[1];
+    head[6] = type[2];
+    head[7] = type[3];
+    put_be32(tail, crc32(crc32(0, head + 4, 4), data, n));
+    if (write_all(fd, head, 8) < 0 || write_all(fd, data, n) < 0 || write_all(fd, tail, 4) < 0) {
+        return -1;
+    }
+    return 0;
+}
+/**
+ * The zlib stream of a PNG written as stored (not compressed) deflate blocks, one IDAT
+ * chunk per block, so the encoder stays cheap and needs no library.
+ */
+typedef struct Deflate {
+    int fd;
+    unsigned char block[5 + BLOCK_MAX];
+    long fill;
+    long remaining;     // raw bytes still to come, to know which block is the last
+    unsigned int a, b;  // adler-32 of the raw bytes
+} Deflate;
+/**
+ * Add raw bytes to the zlib stream, writing a block every time one is full.
+ */
+static int deflate_put(Deflate *z, const unsigned char *p, long n) {
+    while (n > 0) {
+        long take = BLOCK_MAX - z->fill < n ? BLOCK_MAX - z->fill : n;
+        long i;
+        for (i = 0; i < take; i++) {
+            z->block[5 + z->fill + i] = p[i];
+            z->a = (z->a + p[i]) % 65521;
+            z->b = (z->b + z->a) % 65521;
+        }
+        z->fill += take;
+        z->remaining -= take;
+        p += take;
+        n -= take;
+        if (z->fill == BLOCK_MAX || z->remaining == 0) {
+            z->block[0] = z->remaining == 0 ? 1 : 0;
+            z->block[1] = (unsigned char)z->fill;
+            z->block[2] = (unsigned char)(z->fill >> 8);
+            z->block[3] = (unsigned char)~z->fill;
+            z->block[4] = (unsigned char)(~z->fill >> 8);
+            if (write_chunk(z->fd, "IDAT", z->block, 5 + z->fill) < 0) {
+                return -1;
+            }
+            z->fill = 0;
+        }
+    }
+    return 0;
+}
+/**
+ * Write the pixels as an 8 bit RGB PNG file.
+ */
+static int write_png(int fd, const color_t *pixels, int width, int height, int pitch) {
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    static const unsigned char zlibHeader[2] = {0x78, 0x01};
+    static unsigned char row[1 + 3 * CAPTURE_MAX_WIDTH];
+    static Deflate z;
+    unsigned char ihdr[13], adler[4];
+    int y;
+    put_be32(ihdr, (unsigned int)width);
+    put_be32(ihdr + 4, (unsigned int)height);
+    ihdr[8] = 8;    // bits per channel
+    ihdr[9] = 2;    // RGB
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+    if (write_all(fd, signature, 8) < 0 || write_chunk(fd, "IHDR", ihdr, 13) < 0 ||
+        write_chunk(fd, "IDAT", zlibHeader, 2) < 0) {
+        return -1;
+    }
+    z.fd = fd;
+    z.fill = 0;
+    z.remaining = (long)height * (1 + 3L * width);
+    z.a = 1;
+    z.b = 0;
+    row[0] = 0;     // no filter
+    for (y = 0; y < height; y++) {
+        convert_from_screen(row + 1, 3 * width, (const char *)pixels + (long)y * pitch, pitch,
+                            width, 1, PIXEL_RGB888);
+        if (deflate_put(&z, row, 1 + 3L * width) < 0) {
+            return -1;
+        }
+    }
+    put_be32(adler, (z.b << 16) | z.a);
+    if (write_chunk(fd, "IDAT", adler, 4) < 0 || write_chunk(fd, "IEND", adler, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+/**
+ * The background encoder. Take queued captures one by one, write them out and give the
+ * buffer back to the pool.
+ */
+static void *encode_loop(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (queueCount == 0 && !stopping) {
+            pthread_cond_wait(&work, &lock);
+        }
+        if (queueCount == 0) {
+            break;
+        }
+        Capture *capture = &pool[queue[queueHead]];
+        queueHead = (queueHead + 1) % CAPTURE_POOL;
+        queueCount--;
+        pthread_mutex_unlock(&lock);
+
+        int width = bitDepth / 2 < CAPTURE_MAX_WIDTH ? bitDepth / 2 : CAPTURE_MAX_WIDTH;
+        int fd = open(capture->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            if (capture->format == CAPTURE_PNG) {
+                write_png(fd, capture->pixels, width, yLength, bitDepth);
+            } else {
+                write_ppm(fd, capture->pixels, width, yLength, bitDepth);
+            }
+            close(fd);
+        }
+
+        pthread_mutex_lock(&lock);
+        capture->state = FREE;
+        pthread_cond_broadcast(&idle);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+/**
+ * Take a screenshot of what the frameBuffer shows and write it to path in the background,
+ * as CAPTURE_PPM or CAPTURE_PNG. Return 0 when the capture was taken, or -1 when every
+ * pooled buffer is still waiting for the encoder (the capture is dropped) or something
+ * could not be set up.
+ */
+int capture_screen(const char *path, int format) {
+    int i, slot = -1;
+    pthread_mutex_lock(&lock);
+    if (!registered) {
+        // finish what is still being written when the program exits
+        if (atexit(capture_flush) != 0) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        registered = 1;
+    }
+    // capture_flush() is stopping the encoder, the capture is dropped
+    if (stopping) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    if (!started) {
+        if (pthread_create(&encoder, NULL, encode_loop, NULL) != 0) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        started = 1;
+    }
+    for (i = 0; i < CAPTURE_POOL; i++) {
+        if (pool[i].state == FREE) {
+            slot = i;
+            pool[i].state = FILLING;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    if (slot < 0) {
+        return -1;
+    }
+    Capture *capture = &pool[slot];
+    if (capture->pixels == NULL) {
+        void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            pthread_mutex_lock(&lock);
+            capture->state = FREE;
+            pthread_cond_broadcast(&idle);
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        capture->pixels = (color_t *)ptr;
+    }
+    stream_copy(capture->pixels, frameBuffer, size);
+    for (i = 0; i < CAPTURE_PATH - 1 && path[i] != '\0'; i++) {
+        capture->path[i] = path[i];
+    }
+    capture->path[i] = '\0';
+    capture->format = format;
+
+    pthread_mutex_lock(&lock);
+    capture->state = QUEUED;
+    queue[(queueHead + queueCount) % CAPTURE_POOL] = slot;
+    queueCount++;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+/**
+ * Whether every buffer of the pool is back, none being filled, queued or written.
+ * The caller holds the lock.
+ */
+static int pool_idle() {
+    int i;
+    for (i = 0; i < CAPTURE_POOL; i++) {
+        if (pool[i].state != FREE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+/**
+ * Wait until every capture taken so far is written, then stop the encoder thread and give
+ * the pooled buffers back. Captures asked for while it stops the encoder are dropped; the
+ * next capture_screen() after it starts the encoder again.
+ */
+void capture_flush() {
+    int i;
+    pthread_mutex_lock(&lock);
+    if (!started || stopping) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    while (!pool_idle()) {
+        pthread_cond_wait(&idle, &lock);
+    }
+    started = 0;
+    stopping = 1;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+    pthread_join(encoder, NULL);
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < CAPTURE_POOL; i++) {
+        if (pool[i].state == FREE && pool[i].pixels != NULL) {
+            munmap(pool[i].pixels, size);
+            pool[i].pixels = NULL;
+        }
+    }
+    stopping = 0;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,232 @@
+/**
+ * File: convert.c
+ * Author: Quan Nguyen
+ * Project: Graphic Library
+ * Class: CSC252
+ * Purpose: This is the bulk color conversion part of the library. It turns whole images of
+ * 24 bit (RGB888) or 32 bit (ARGB8888) pixels into the color_t format of the frameBuffer and
+ * back, for image uploads and screenshots. Going to color_t can use a 4x4 ordered dither so
+ * gradients do not band. The work is done several pixels at a time with SSE2/SSSE3/AVX2 when
+ * the compiler targets them, and one pixel at a time otherwise.
+ */
+#include "library.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+/**
+ * 4x4 Bayer matrix used for the ordered dither, values 0..15.
+ */
+static const unsigned char bayer[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+/**
+ * Pack 8 bit channels into a color_t by dropping the low bits.
+ */
+static color_t pack565(int r, int g, int b) {
+    return (color_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+/**
+ * Add the dither offset of one pixel to a channel, without going over 255.
+ */
+static int dither_add(int value, int offset) {
+    value += offset;
+    return value > 255 ? 255 : value;
+}
+#if defined(__SSE2__)
+/**
+ * Turn 4 ARGB8888 pixels (one in each 32 bit lane) into color_t kept in the low half of
+ * every lane, sign extended so that _mm_packs_epi32 does not saturate them.
+ */
+static __m128i argb_to_565_epi32(__m128i p) {
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    __m128i c = _mm_or_si128(_mm_or_si128(r, g), b);
+    return _mm_srai_epi32(_mm_slli_epi32(c, 16), 16);
+}
+/**
+ * Build the dither offsets of 4 pixels of row y as bytes b, g, r, a of 4 lanes. Red and
+ * blue lose 3 bits so they get 0..7, green loses 2 bits so it gets 0..3.
+ */
+static __m128i dither_row(int y) {
+    unsigned int lane[4];
+    int k;
+    for (k = 0; k < 4; k++) {
+        unsigned int d = bayer[y & 3][k];
+        lane[k] = (d >> 1) | ((d >> 2) << 8) | ((d >> 1) << 16);
+    }
+    return _mm_setr_epi32((int)lane[0], (int)lane[1], (int)lane[2], (int)lane[3]);
+}
+#endif
+/**
+ * Convert one row of ARGB8888 pixels to color_t. The alpha channel is ignored.
+ */
+static void argb_row_to_565(color_t *dst, const unsigned int *src, int n, int y, int dither) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i d8 = _mm256_broadcastsi128_si256(dither ? dither_row(y) : _mm_setzero_si128());
+    for (; i + 16 <= n; i += 16) {
+        __m256i p0 = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)(src + i)), d8);
+        __m256i p1 = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)(src + i + 8)), d8);
+        const __m256i mr = _mm256_set1_epi32(0xf800), mg = _mm256_set1_epi32(0x07e0);
+        const __m256i mb = _mm256_set1_epi32(0x001f);
+        __m256i c0 = _mm256_or_si256(_mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(p0, 8), mr), _mm256_and_si256(_mm256_srli_epi32(p0, 5), mg)),
+            _mm256_and_si256(_mm256_srli_epi32(p0, 3), mb));
+        __m256i c1 = _mm256_or_si256(_mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(p1, 8), mr), _mm256_and_si256(_mm256_srli_epi32(p1, 5), mg)),
+            _mm256_and_si256(_mm256_srli_epi32(p1, 3), mb));
+        c0 = _mm256_srai_epi32(_mm256_slli_epi32(c0, 16), 16);
+        c1 = _mm256_srai_epi32(_mm256_slli_epi32(c1, 16), 16);
+        // the pack works inside each 128 bit half, put the quarters back in order
+        __m256i c = _mm256_permute4x64_epi64(_mm256_packs_epi32(c0, c1), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + i), c);
+    }
+#elif defined(__SSE2__)
+    __m128i d8 = dither ? dither_row(y) : _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i p0 = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)(src + i)), d8);
+        __m128i p1 = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)(src + i + 4)), d8);
+        __m128i c = _mm_packs_epi32(argb_to_565_epi32(p0), argb_to_565_epi32(p1));
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    }
+#endif
+    for (; i < n; i++) {
+        int r = (src[i] >> 16) & 0xff, g = (src[i] >> 8) & 0xff, b = src[i] & 0xff;
+        if (dither) {
+            int d = bayer[y & 3][i & 3];
+            r = dither_add(r, d >> 1);
+            g = dither_add(g, d >> 2);
+            b = dither_add(b, d >> 1);
+        }
+        dst[i] = pack565(r, g, b);
+    }
+}
+/**
+ * Convert one row of RGB888 pixels (bytes r, g, b) to color_t. With SSSE3 every 12 bytes
+ * are shuffled into 4 ARGB8888 lanes and go through the same packing as above.
+ */
+static void rgb_row_to_565(color_t *dst, const unsigned char *src, int n, int y, int dither) {
+    int i = 0;
+#if defined(__SSSE3__)
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    __m128i d8 = dither ? dither_row(y) : _mm_setzero_si128();
+    // the loads read 16 bytes for 12, stop while a whole load still fits the row
+    for (; 3 * i + 28 <= 3 * n; i += 8) {
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), shuf);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i + 12)), shuf);
+        p0 = _mm_adds_epu8(p0, d8);
+        p1 = _mm_adds_epu8(p1, d8);
+        __m128i c = _mm_packs_epi32(argb_to_565_epi32(p0), argb_to_565_epi32(p1));
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    }
+#endif
+    for (; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        if (dither) {
+            int d = bayer[y & 3][i & 3];
+            r = dither_add(r, d >> 1);
+            g = dither_add(g, d >> 2);
+            b = dither_add(b, d >> 1);
+        }
+        dst[i] = pack565(r, g, b);
+    }
+}
+/**
+ * Convert one row of color_t to ARGB8888 with an opaque alpha. The low bits of every
+ * channel repeat its high bits so that white stays 0xffffffff.
+ */
+static void row_565_to_argb(unsigned int *dst, const color_t *src, int n) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    for (; i + 8 <= n; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i half[2] = {_mm_unpacklo_epi16(c, zero), _mm_unpackhi_epi16(c, zero)};
+        int k;
+        for (k = 0; k < 2; k++) {
+            __m128i p = half[k];
+            __m128i r = _mm_srli_epi32(p, 11);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x3f));
+            __m128i b = _mm_and_si128(p, _mm_set1_epi32(0x1f));
+            r = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+            g = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4));
+            b = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+            p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(g, 8)), _mm_or_si128(b, alpha));
+            _mm_storeu_si128((__m128i *)(dst + i + 4 * k), p);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        int r = src[i] >> 11, g = (src[i] >> 5) & 0x3f, b = src[i] & 0x1f;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        dst[i] = 0xff000000u | (unsigned int)(r << 16) | (unsigned int)(g << 8) | (unsigned int)b;
+    }
+}
+/**
+ * Convert one row of color_t to RGB888 bytes. With SSSE3 the ARGB8888 lanes are squeezed
+ * down to 12 bytes per 4 pixels; the 16 byte stores overlap and the last ones are done
+ * one pixel at a time so nothing is written past the row.
+ */
+static void row_565_to_rgb(unsigned char *dst, const color_t *src, int n) {
+    int i = 0;
+#if defined(__SSSE3__)
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    unsigned int argb[8] __attribute__((aligned(16)));
+    for (; 3 * i + 28 <= 3 * n; i += 8) {
+        row_565_to_argb(argb, src + i, 8);
+        __m128i p0 = _mm_shuffle_epi8(_mm_load_si128((const __m128i *)argb), shuf);
+        __m128i p1 = _mm_shuffle_epi8(_mm_load_si128((const __m128i *)(argb + 4)), shuf);
+        _mm_storeu_si128((__m128i *)(dst + 3 * i), p0);
+        _mm_storeu_si128((__m128i *)(dst + 3 * i + 12), p1);
+    }
+#endif
+    for (; i < n; i++) {
+        int r = src[i] >> 11, g = (src[i] >> 5) & 0x3f, b = src[i] & 0x1f;
+        dst[3 * i] = (unsigned char)((r << 3) | (r >> 2));
+        dst[3 * i + 1] = (unsigned char)((g << 2) | (g >> 4));
+        dst[3 * i + 2] = (unsigned char)((b << 3) | (b >> 2));
+    }
+}
+/**
+ * Convert a width x height image in format (PIXEL_RGB888 or PIXEL_ARGB8888) to color_t.
+ * Both pitches are the length of one row in bytes. flags can hold CONVERT_DITHER to use
+ * an ordered dither instead of cutting the low bits.
+ */
+void convert_to_screen(void *dst, int dstPitch, const void *src, int srcPitch,
+                       int width, int height, int format, int flags) {
+    int y;
+    int dither = (flags & CONVERT_DITHER) != 0;
+    for (y = 0; y < height; y++) {
+        color_t *out = (color_t *)((char *)dst + (long)y * dstPitch);
+        const char *in = (const char *)src + (long)y * srcPitch;
+        if (format == PIXEL_ARGB8888) {
+            argb_row_to_565(out, (const unsigned int *)in, width, y, dither);
+        } else {
+            rgb_row_to_565(out, (const unsigned char *)in, width, y, dither);
+        }
+    }
+}
+/**
+ * Convert a width x height image of color_t to format (PIXEL_RGB888 or PIXEL_ARGB8888).
+ * Both pitches are the length of one row in bytes.
+ */
+void convert_from_screen(void *dst, int dstPitch, const void *src, int srcPitch,
+                         int width, int height, int format) {
+    int y;
+    for (y = 0; y < height; y++) {
+        char *out = (char *)dst + (long)y * dstPitch;
+        const color_t *in = (const color_t *)((const char *)src + (long)y * srcPitch);
+        if (format == PIXEL_ARGB8888) {
+            row_565_to_argb((unsigned int *)out, in, width);
+        } else {
+            row_565_to_rgb((unsigned char *)out, in, width);
+        }
+    }
+}
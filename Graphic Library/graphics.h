@@ -10,6 +10,11 @@
 #define MYGRAPHIC
 typedef unsigned short color_t;
 #define RGB(r, g, b) ((color_t)((r) << 11) | (g) << 5 | (b))
+/**
+ * Convert 8 bit channels, clamped to 0..255, to a color_t
+ */
+#define CLAMP8(v) ((v) < 0 ? 0 : (v) > 255 ? 255 : (v))
+#define RGB888(r, g, b) ((color_t)((CLAMP8(r) >> 3) << 11 | (CLAMP8(g) >> 2) << 5 | CLAMP8(b) >> 3))
 /**
  * Initialize the graphic library
  */
@@ -46,4 +51,95 @@ void *create_buffer();
  * A memory copy from our offscreen buffer to the framebuffer
  */
 void blit(void *src); 
+/**
+ * Flags for create_shadow_buffer(): cache friendly row length and 2 MiB pages
+ */
+#define BUFFER_PADDED 1
+#define BUFFER_HUGEPAGE 2
+/**
+ * Create a second buffer with a padded row length and/or huge pages
+ */
+void *create_shadow_buffer(int flags);
+/**
+ * Give back a buffer from create_buffer() or create_shadow_buffer()
+ */
+void destroy_buffer(void *buf);
+/**
+ * Get the length of one row of a buffer in pixels
+ */
+int buffer_pitch(void *img);
+/**
+ * Maximum number of layers the compositor can hold
+ */
+#define LAYER_MAX 16
+typedef struct layer layer_t;
+/**
+ * Create a layer on top of a buffer from create_buffer()
+ */
+layer_t *create_layer(void *buf, int width, int height);
+/**
+ * Remove a layer from the screen
+ */
+void destroy_layer(layer_t *layer);
+/**
+ * Move a layer to a new position on the screen
+ */
+void layer_move(layer_t *layer, int x, int y);
+/**
+ * Change the z-order of a layer, higher is on top
+ */
+void layer_set_z(layer_t *layer, int z);
+/**
+ * Change the opacity of a layer, from 0 to 255
+ */
+void layer_set_opacity(layer_t *layer, int opacity);
+/**
+ * Mark a rectangle of a layer as changed
+ */
+void layer_mark_dirty(layer_t *layer, int x, int y, int w, int h);
+/**
+ * Compose the dirty tiles of all layers and show them
+ */
+int compose_layers(void *present);
+/**
+ * Pixel formats for the bulk conversion: bytes r, g, b and 32 bit words 0xAARRGGBB
+ */
+#define PIXEL_RGB888 0
+#define PIXEL_ARGB8888 1
+/**
+ * Flag for convert_to_screen() to use an ordered dither
+ */
+#define CONVERT_DITHER 1
+/**
+ * Convert a whole image of 24 or 32 bit pixels to color_t
+ */
+void convert_to_screen(void *dst, int dstPitch, const void *src, int srcPitch,
+                       int width, int height, int format, int flags);
+/**
+ * Convert a whole image of color_t to 24 or 32 bit pixels
+ */
+void convert_from_screen(void *dst, int dstPitch, const void *src, int srcPitch,
+                         int width, int height, int format);
+/**
+ * File formats for capture_screen()
+ */
+#define CAPTURE_PPM 0
+#define CAPTURE_PNG 1
+/**
+ * Take a screenshot and write it to a file in the background
+ */
+int capture_screen(const char *path, int format);
+/**
+ * Wait for every screenshot to be written
+ */
+void capture_flush();
+/**
+ * Fill a triangle with one color
+ */
+void fill_triangle(void *img, int x1, int y1, int x2, int y2, int x3, int y3, color_t c);
+/**
+ * Fill a triangle blending the colors of its corners
+ */
+void shade_triangle(void *img, int x1, int y1, color_t c1, int x2, int y2, color_t c2,
+                    int x3, int y3, color_t c3);
 #endif
@@ -9,7 +9,7 @@
  * library will not use any function orginated from C library but rather use Linux 
  * system call directly. 
  */
-#include "graphics.h"
+#include "library.h"
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -28,6 +28,16 @@ int fileDescriptor;
 int yLength, bitDepth, size;
 // struct of the terminal. There are two in order for us to restore the previous one
 struct termios old, new;
+// size of a huge page, the shadow buffers are aligned to it
+#define HUGE_SIZE (2L * 1024 * 1024)
+// the shadow buffers, with the length of their mapping and of their rows; a free slot
+// has no ptr
+#define SHADOW_MAX 16
+static struct shadow {
+    void *ptr;
+    long bytes;
+    int pitch;      // in pixels
+} shadows[SHADOW_MAX];
 /**
  * Initialize the graphic library. Open up a file, /dev/fb0, that represents 
  * the first (zero-th) framebuffer attached to the computer. Then, use mmap to get 
@@ -92,23 +102,30 @@ void sleep_ms(long ms) {
 void clear_screen(void *img) {
     color_t *charImg = (color_t *)img; 
     int i = 0; 
-    while (i < (yLength*bitDepth/2)) {
+    int pixels = yLength*buffer_pitch(img);
+    while (i < pixels) {
         charImg[i] = 0; 
         i++;
     } 
 }
 /**
- * Draw content to a pixel. 
+ * Draw content to a pixel of a buffer whose rows are pitch pixels long, for the drawing
+ * functions that look the pitch up once for all their pixels.
  */
-void draw_pixel(void *img, int x, int y, color_t color) { 
+static void put_pixel(color_t *img, int pitch, int x, int y, color_t color) {
     if (x <0 || y < 0) {
         return;
     }
     if (x > bitDepth/2 || y > yLength) {
         return; 
     }
-    color_t *castImg = (color_t *)img;
-    castImg[y*(bitDepth/2)+x] = color; 
+    img[y*pitch+x] = color; 
+}
+/**
+ * Draw content to a pixel. 
+ */
+void draw_pixel(void *img, int x, int y, color_t color) { 
+    put_pixel((color_t *)img, buffer_pitch(img), x, y, color);
 }
 /**
  * Get the absolute value of a number and return it. 
@@ -129,9 +146,10 @@ void draw_line(void *img, int x1, int y1, int x2, int y2, color_t c)
    int dx =  absoluteVal(x2-x1), sx = x1<x2 ? 1 : -1;
    int dy = -absoluteVal(y2-y1), sy = y1<y2 ? 1 : -1; 
    int err = dx+dy, e2; /* error value e_xy */
+   int pitch = buffer_pitch(img);
  
    for(;;){  /* loop */
-      draw_pixel(img, x1,y1, c);
+      put_pixel((color_t *)img, pitch, x1,y1, c);
       if (x1==x2 && y1==y2) break;
       e2 = 2*err;
       if (e2 >= dy) { err += dy; x1 += sx; } /* e_xy+e_x > 0 */
@@ -147,15 +165,113 @@ void *create_buffer() {
     void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
     return ptr; 
 }
+/**
+ * Create a shadow buffer. BUFFER_PADDED makes every row a bit longer than the screen row
+ * so that it is a whole and odd number of 64 byte cache lines: walking down a column then
+ * uses every cache set instead of hitting the same few ones, which happens when the row
+ * length is a power of two. BUFFER_HUGEPAGE backs the buffer with 2 MiB pages, from the
+ * reserved pool if there is one and as transparent huge pages otherwise, so a column
+ * walk does not need a new TLB entry every few rows. At most SHADOW_MAX of them exist at
+ * once, destroy_buffer() gives one back. Return NULL on failure, also when all of them are
+ * in use, rather than a buffer without what flags asked for.
+ */
+void *create_shadow_buffer(int flags) {
+    int pitch = bitDepth, slot = 0;
+    while (slot < SHADOW_MAX && shadows[slot].ptr != NULL) {
+        slot++;
+    }
+    if (slot == SHADOW_MAX) {
+        return NULL;
+    }
+    if (flags & BUFFER_PADDED) {
+        pitch = (bitDepth + 63) & ~63;
+        if ((pitch / 64) % 2 == 0) {
+            pitch += 64;
+        }
+    }
+    long bytes = (long)pitch * yLength;
+    char *ptr = MAP_FAILED;
+    if (flags & BUFFER_HUGEPAGE) {
+        bytes = (bytes + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+        ptr = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            // no reserved huge pages, map a bit more to cut out a 2 MiB aligned range
+            char *raw = mmap(NULL, bytes + HUGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if (raw != MAP_FAILED) {
+                ptr = (char *)(((unsigned long)raw + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+                if (ptr > raw) {
+                    munmap(raw, ptr - raw);
+                }
+                munmap(ptr + bytes, raw + bytes + HUGE_SIZE - (ptr + bytes));
+                madvise(ptr, bytes, MADV_HUGEPAGE);
+            }
+        }
+    } else {
+        ptr = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+    shadows[slot].ptr = ptr;
+    shadows[slot].bytes = bytes;
+    shadows[slot].pitch = pitch / 2;
+    return ptr;
+}
+/**
+ * Give back a buffer from create_buffer() or create_shadow_buffer(), never the frameBuffer.
+ * A shadow buffer leaves the registry, so its slot can be used again.
+ */
+void destroy_buffer(void *buf) {
+    int i;
+    if (buf == NULL) {
+        return;
+    }
+    for (i = 0; i < SHADOW_MAX; i++) {
+        if (shadows[i].ptr == buf) {
+            munmap(buf, shadows[i].bytes);
+            shadows[i].ptr = NULL;
+            return;
+        }
+    }
+    munmap(buf, size);
+}
+/**
+ * Get the length of one row of a buffer in pixels. It is the screen row for the
+ * frameBuffer and create_buffer(), and may be longer for create_shadow_buffer().
+ * It looks through the registry of shadow buffers, so drawing functions call it once
+ * and not for every pixel.
+ */
+int buffer_pitch(void *img) {
+    int i;
+    if (img != frameBuffer) {
+        for (i = 0; i < SHADOW_MAX; i++) {
+            if (shadows[i].ptr == img) {
+                return shadows[i].pitch;
+            }
+        }
+    }
+    return bitDepth/2;
+}
 /**
  * A memory copy from our offscreen buffer to the frameBuffer. The frameBuffer is 
- * the original stuff 
+ * the original stuff. A padded shadow buffer is copied row by row, leaving out the
+ * padding at the end of each row.
  */
 void blit(void *src) { 
     // casting the src pointer in order to get byte access 
     color_t *castSrc = (color_t *)src;  
+    int pitch = buffer_pitch(src);
     int i = 0; 
-    for (i = 0; i < (size/2); i++) {
-        frameBuffer[i] = castSrc[i];
+    if (pitch == bitDepth/2) {
+        for (i = 0; i < (size/2); i++) {
+            frameBuffer[i] = castSrc[i];
+        }
+        return;
+    }
+    int y;
+    for (y = 0; y < yLength; y++) {
+        for (i = 0; i < bitDepth/2; i++) {
+            frameBuffer[y*(bitDepth/2)+i] = castSrc[y*pitch+i];
+        }
     }
 } 
@@ -0,0 +1,18 @@
+/**
+ * File: library.h
+ * Author: Quan Nguyen
+ * Project: Graphic Library
+ * Class: CSC252
+ * Purpose: This is the private header shared by the source files of the library. It exposes
+ * the framebuffer globals that init_graphics() fills in so that the extra modules (layers,
+ * conversion, ...) can work on the same screen. Programs using the library should only
+ * include graphics.h.
+ */
+#ifndef MYGRAPHIC_LIBRARY
+#define MYGRAPHIC_LIBRARY
+#include "graphics.h"
+// the pointer from mmap of /dev/fb0
+extern color_t *frameBuffer;
+// the number of rows, the length of one row in bytes and the size of the whole map
+extern int yLength, bitDepth, size;
+#endif
@@ -0,0 +1,223 @@
+/**
+ * File: triangle.c
+ * Author: Quan Nguyen
+ * Project: Graphic Library
+ * Class: CSC252
+ * Purpose: This is the triangle rasterizer of the library. Instead of walking the outline with
+ * draw_line(), every pixel is tested against the three edge functions of the triangle (half-space
+ * rasterization). The bounding box is walked in 8x8 blocks: blocks fully outside one edge are
+ * skipped, blocks fully inside all edges are filled without tests, and the rest are tested 8
+ * pixels at a time with AVX2. Pixels exactly on an edge follow the top-left rule, so two
+ * triangles sharing an edge never draw it twice and never leave a gap. The color is either flat
+ * or interpolated between the three corners (Gouraud shading).
+ */
+#include "library.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+// the blocks are BLOCK x BLOCK pixels
+#define BLOCK 8
+// coordinates outside of this range could overflow the edge functions
+#define COORD_LIMIT (1 << 14)
+/**
+ * Everything the inner loops need to know about one triangle. Edge i is the one facing
+ * corner i, its function is a*x + b*y + c and a pixel is inside when it is 0 or more.
+ * k[ch][i] is channel ch (red, green, blue) of corner i divided by twice the area, so the
+ * channel at a pixel is the sum of k[ch][i] * w_i.
+ */
+typedef struct Setup {
+    int a[3], b[3], c[3];
+    int gouraud;
+    color_t flat;
+    float k[3][3];
+} Setup;
+// largest value of each channel of a color_t
+static const float channelMax[3] = {31.0f, 63.0f, 31.0f};
+/**
+ * Get the color of one pixel from its edge function values.
+ */
+static color_t shade(const Setup *s, int w0, int w1, int w2) {
+    if (!s->gouraud) {
+        return s->flat;
+    }
+    int ch, v[3];
+    for (ch = 0; ch < 3; ch++) {
+        float f = w0 * s->k[ch][0] + w1 * s->k[ch][1] + w2 * s->k[ch][2];
+        f = f < 0.0f ? 0.0f : f > channelMax[ch] ? channelMax[ch] : f;
+        v[ch] = (int)(f + 0.5f);
+    }
+    return (color_t)((v[0] << 11) | (v[1] << 5) | v[2]);
+}
+/**
+ * Draw the pixels of one row of a block, from x for n pixels, one at a time. w0..w2 are
+ * the edge functions at the first pixel. When full is set they are all inside.
+ */
+static void row_scalar(color_t *row, int x, int n, int w0, int w1, int w2, const Setup *s, int full) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (full || (w0 | w1 | w2) >= 0) {
+            row[x + i] = shade(s, w0, w1, w2);
+        }
+        w0 += s->a[0];
+        w1 += s->a[1];
+        w2 += s->a[2];
+    }
+}
+#if defined(__AVX2__)
+/**
+ * Draw 8 pixels of one row starting at x, testing all of them at once. When full is set
+ * the whole row of the block is known to be inside and the test is skipped.
+ */
+static void row_avx2(color_t *row, int x, int w0, int w1, int w2, const Setup *s, int full) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(w0), _mm256_mullo_epi32(lane, _mm256_set1_epi32(s->a[0])));
+    __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(w1), _mm256_mullo_epi32(lane, _mm256_set1_epi32(s->a[1])));
+    __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(w2), _mm256_mullo_epi32(lane, _mm256_set1_epi32(s->a[2])));
+    // a lane is inside when none of the three values has the sign bit set
+    __m256i inside = _mm256_cmpgt_epi32(_mm256_setzero_si256(),
+                                        _mm256_or_si256(_mm256_or_si256(e0, e1), e2));
+    inside = _mm256_xor_si256(inside, _mm256_set1_epi32(-1));
+    if (!full && _mm256_testz_si256(inside, inside)) {
+        return;
+    }
+    __m256i color;
+    if (s->gouraud) {
+        __m256 f0 = _mm256_cvtepi32_ps(e0), f1 = _mm256_cvtepi32_ps(e1), f2 = _mm256_cvtepi32_ps(e2);
+        __m256i v[3];
+        int ch;
+        for (ch = 0; ch < 3; ch++) {
+            __m256 f = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(f0, _mm256_set1_ps(s->k[ch][0])),
+                                                   _mm256_mul_ps(f1, _mm256_set1_ps(s->k[ch][1]))),
+                                     _mm256_mul_ps(f2, _mm256_set1_ps(s->k[ch][2])));
+            f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps(channelMax[ch]));
+            v[ch] = _mm256_cvttps_epi32(_mm256_add_ps(f, _mm256_set1_ps(0.5f)));
+        }
+        color = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(v[0], 11), _mm256_slli_epi32(v[1], 5)), v[2]);
+    } else {
+        color = _mm256_set1_epi32(s->flat);
+    }
+    // squeeze the 8 lanes of 32 bits into 8 pixels of 16 bits
+    __m128i out = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(color, color), 0x08));
+    if (full) {
+        _mm_storeu_si128((__m128i *)(row + x), out);
+    } else {
+        __m128i mask = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packs_epi32(inside, inside), 0x08));
+        __m128i old = _mm_loadu_si128((const __m128i *)(row + x));
+        _mm_storeu_si128((__m128i *)(row + x), _mm_blendv_epi8(old, out, mask));
+    }
+}
+#endif
+/**
+ * Check whether an edge from (xa, ya) to (xb, yb) is a top edge (flat, with the triangle
+ * under it) or a left edge. Pixels exactly on those belong to the triangle, pixels exactly
+ * on the other edges belong to the neighbor.
+ */
+static int top_left(int xa, int ya, int xb, int yb) {
+    return yb - ya < 0 || (yb == ya && xb - xa > 0);
+}
+/**
+ * Rasterize the triangle with corners (x[i], y[i]) and colors col[i] into img.
+ */
+static void raster(color_t *img, int x[3], int y[3], color_t col[3], int gouraud) {
+    int i, width = bitDepth / 2, pitch = buffer_pitch(img);
+    for (i = 0; i < 3; i++) {
+        if (x[i] <= -COORD_LIMIT || x[i] >= COORD_LIMIT || y[i] <= -COORD_LIMIT || y[i] >= COORD_LIMIT) {
+            return;
+        }
+    }
+    long area = (long)(x[1] - x[0]) * (y[2] - y[0]) - (long)(y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) {
+        return;
+    }
+    if (area < 0) { // make the corners go the same way around for every triangle
+        int t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+        color_t c = col[1]; col[1] = col[2]; col[2] = c;
+        area = -area;
+    }
+    Setup s;
+    for (i = 0; i < 3; i++) {
+        int a = (i + 1) % 3, b = (i + 2) % 3;
+        int dx = x[b] - x[a], dy = y[b] - y[a];
+        s.a[i] = -dy;
+        s.b[i] = dx;
+        s.c[i] = dy * x[a] - dx * y[a] - (top_left(x[a], y[a], x[b], y[b]) ? 0 : 1);
+        s.k[0][i] = (float)(col[i] >> 11) / (float)area;
+        s.k[1][i] = (float)((col[i] >> 5) & 0x3f) / (float)area;
+        s.k[2][i] = (float)(col[i] & 0x1f) / (float)area;
+    }
+    s.gouraud = gouraud;
+    s.flat = col[0];
+    // bounding box clipped to the screen
+    int minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+    for (i = 1; i < 3; i++) {
+        minX = x[i] < minX ? x[i] : minX;
+        maxX = x[i] > maxX ? x[i] : maxX;
+        minY = y[i] < minY ? y[i] : minY;
+        maxY = y[i] > maxY ? y[i] : maxY;
+    }
+    minX = minX < 0 ? 0 : minX;
+    minY = minY < 0 ? 0 : minY;
+    maxX = maxX > width - 1 ? width - 1 : maxX;
+    maxY = maxY > yLength - 1 ? yLength - 1 : maxY;
+
+    int bx, by, row;
+    for (by = minY & ~(BLOCK - 1); by <= maxY; by += BLOCK) {
+        for (bx = minX & ~(BLOCK - 1); bx <= maxX; bx += BLOCK) {
+            // smallest and largest value of each edge function over the block
+            int out = 0, full = 1;
+            for (i = 0; i < 3; i++) {
+                int w = s.a[i] * bx + s.b[i] * by + s.c[i];
+                int lo = w + (s.a[i] < 0 ? s.a[i] : 0) * (BLOCK - 1) + (s.b[i] < 0 ? s.b[i] : 0) * (BLOCK - 1);
+                int hi = w + (s.a[i] > 0 ? s.a[i] : 0) * (BLOCK - 1) + (s.b[i] > 0 ? s.b[i] : 0) * (BLOCK - 1);
+                if (hi < 0) {
+                    out = 1;
+                }
+                if (lo < 0) {
+                    full = 0;
+                }
+            }
+            if (out) {
+                continue;
+            }
+            int y0 = by > minY ? by : minY;
+            int y1 = by + BLOCK - 1 < maxY ? by + BLOCK - 1 : maxY;
+            for (row = y0; row <= y1; row++) {
+                color_t *line = img + (long)row * pitch;
+                int w0 = s.a[0] * bx + s.b[0] * row + s.c[0];
+                int w1 = s.a[1] * bx + s.b[1] * row + s.c[1];
+                int w2 = s.a[2] * bx + s.b[2] * row + s.c[2];
+#if defined(__AVX2__)
+                // the 8 wide path may touch pixels left of minX or right of maxX (or the
+                // padding) in the same row; they are outside and written back unchanged
+                if (bx + BLOCK <= pitch) {
+                    row_avx2(line, bx, w0, w1, w2, &s, full);
+                    continue;
+                }
+#endif
+                int x0 = bx > minX ? bx : minX;
+                int x1 = bx + BLOCK - 1 < maxX ? bx + BLOCK - 1 : maxX;
+                row_scalar(line, x0, x1 - x0 + 1, w0 + s.a[0] * (x0 - bx),
+                           w1 + s.a[1] * (x0 - bx), w2 + s.a[2] * (x0 - bx), &s, full);
+            }
+        }
+    }
+}
+/**
+ * Fill the triangle with corners (x1, y1), (x2, y2) and (x3, y3) with one color.
+ */
+void fill_triangle(void *img, int x1, int y1, int x2, int y2, int x3, int y3, color_t c) {
+    int x[3] = {x1, x2, x3}, y[3] = {y1, y2, y3};
+    color_t col[3] = {c, c, c};
+    raster((color_t *)img, x, y, col, 0);
+}
+/**
+ * Fill the triangle with corners (x1, y1), (x2, y2) and (x3, y3), blending the colors
+ * c1, c2 and c3 of the corners across it.
+ */
+void shade_triangle(void *img, int x1, int y1, color_t c1, int x2, int y2, color_t c2,
+                    int x3, int y3, color_t c3) {
+    int x[3] = {x1, x2, x3}, y[3] = {y1, y2, y3};
+    color_t col[3] = {c1, c2, c3};
+    raster((color_t *)img, x, y, col, 1);
+}
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * include/uapi/linux/csc452_msg.h
+ *
+ * Types and flags shared by the csc452 message syscalls in kernel/sys.c and
+ * the programs that call them (osmsg, msgstress).
+ */
+#ifndef _UAPI_LINUX_CSC452_MSG_H
+#define _UAPI_LINUX_CSC452_MSG_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * mailboxes belong to uids: a message is sent to a uid, the sender is the uid
+ * of the caller, and every receiving call reads the mailbox of the caller.
+ * Group names are at most 32 characters, plus the NULL.
+ */
+#define CSC452_NAME_MAX		33
+/* messages are cut to 1023 characters, plus the NULL */
+#define CSC452_MSG_MAX		1024
+
+/*
+ * csc452_send_data takes len bytes of anything, NULLs included. Up to
+ * CSC452_INLINE_MAX of them travel like a text message and come out of
+ * csc452_get_msgs and the ring with their len. A bigger payload, a blob of up
+ * to CSC452_BLOB_MAX bytes, is kept in pages and comes out of
+ * csc452_get_blob as a file the receiver maps, so its bytes are copied once
+ * on the way in and never on the way out. Blobs come out in the order they
+ * were sent, whatever their priority.
+ */
+#define CSC452_INLINE_MAX	(CSC452_MSG_MAX - 1)
+#define CSC452_BLOB_MAX		(64 << 20)
+
+/*
+ * priorities of a message, 0 is the most urgent. Receivers get every message
+ * of a priority before any of the next one, and the order of sending within
+ * one priority.
+ */
+#define CSC452_PRIO_LEVELS	8
+#define CSC452_PRIO_DEFAULT	4
+
+/*
+ * a ttl is how many milliseconds a message may wait in its mailbox before it
+ * is dropped unread; a ttl of 0 keeps it until it is received
+ */
+#define CSC452_TTL_NONE		0
+
+/* most messages csc452_get_msgs or csc452_send_msgs handle in one call */
+#define CSC452_BATCH_MAX	4096
+
+/* most members csc452_set_group takes for one group */
+#define CSC452_GROUP_MAX	4096
+
+/*
+ * one message as returned by csc452_get_msgs: the uid of the sender, the
+ * length of msg without the NULL, and the text
+ */
+struct csc452_msg {
+	__u32 from;
+	__u32 len;
+	char msg[CSC452_MSG_MAX];
+};
+
+/* set in *status by csc452_get_msgs when messages were left behind */
+#define CSC452_MORE		0x1
+/* set in *status by csc452_get_msgs when blobs wait for csc452_get_blob */
+#define CSC452_BLOBS		0x2
+
+/*
+ * flags of csc452_get_msgs: sleep until a message comes or the timeout ends.
+ * flags of csc452_send_msgs: sleep while a quota is full instead of failing
+ * with -EAGAIN.
+ */
+#define CSC452_WAIT		0x1
+/*
+ * more flags of csc452_get_msgs. CSC452_PEEK copies the messages but leaves
+ * them in the mailbox. CSC452_FROM only gets the messages sent by the uid in
+ * its from argument. CSC452_COUNT copies nothing and returns how many
+ * messages there are, msgs and max are not used then.
+ */
+#define CSC452_PEEK		0x2
+#define CSC452_FROM		0x4
+#define CSC452_COUNT		0x8
+
+/*
+ * one message for csc452_send_msgs. msg is a user pointer stored as __u64 so
+ * the layout is the same for 32 and 64 bit callers; to is the uid of the
+ * recipient, len the length of msg without the NULL, prio its priority and
+ * ttl like the one of csc452_send_msg. The kernel fills in status with 0 when
+ * the message was queued or a negative errno when it was not.
+ */
+struct csc452_send {
+	__u64 msg;
+	__u32 to;
+	__u32 len;
+	__s32 status;
+	__u32 prio;
+	__u32 ttl;
+	__u32 reserved;
+};
+
+/* flags of csc452_msg_fd: close the fd on exec, make reading it not block */
+#define CSC452_FD_CLOEXEC	0x1
+#define CSC452_FD_NONBLOCK	0x2
+
+/*
+ * what csc452_get_blob tells about the blob behind the fd it returns: the uid
+ * of the sender and the length. The fd maps read only, the last page padded
+ * with zeros, and can be read() too.
+ */
+struct csc452_blob {
+	__u32 from;
+	__u32 reserved;
+	__u64 len;
+};
+
+/*
+ * flags of csc452_get_blob: CSC452_WAIT to sleep until a blob comes or the
+ * timeout ends, and close the fd on exec
+ */
+#define CSC452_BLOB_CLOEXEC	0x2
+
+/*
+ * the ring a receiver maps from /dev/csc452_msg. The kernel copies every
+ * message for the attached mailbox into slot[head % CSC452_RING_SLOTS] and then
+ * moves head; the receiver reads slot[tail % CSC452_RING_SLOTS] and then
+ * moves tail, with no syscall while head != tail. Both are free running
+ * counters and sit on their own cache lines. When the ring is empty the
+ * receiver sleeps in CSC452_RING_WAIT or poll(); a sender only pays for the
+ * wake up when somebody sleeps there.
+ */
+#define CSC452_RING_SLOTS	256
+
+struct csc452_ring {
+	__u32 head;	/* written by the kernel only */
+	__u32 pad0[15];
+	__u32 tail;	/* written by the receiver only */
+	__u32 pad1[15];
+	struct csc452_msg slot[CSC452_RING_SLOTS];
+};
+
+#define CSC452_IOC_MAGIC	0xC4
+/* bind the ring of the file to the mailbox of the caller */
+#define CSC452_RING_ATTACH	_IO(CSC452_IOC_MAGIC, 1)
+/* sleep until the ring has messages, the argument is the timeout in ms */
+#define CSC452_RING_WAIT	_IO(CSC452_IOC_MAGIC, 2)
+
+#endif /* _UAPI_LINUX_CSC452_MSG_H */
@@ -0,0 +1,97 @@
+/**
+ * File: fuzzmain.c
+ * Author: Quan Nguyen
+ * Project:  Syscalls
+ * Class: CSC252
+ * Purpose: This is a small driver for msgfuzz.c on machines without clang, where libFuzzer is
+ * missing. It is linked in place of libFuzzer and calls LLVMFuzzerTestOneInput the same way:
+ * first with every file given on the command line (or every file in a given directory, so a
+ * libFuzzer corpus can be replayed), then with random inputs. There is no coverage feedback,
+ * so it only finds what random bytes reach, but AddressSanitizer and the checks of msgfuzz.c
+ * still run on every input. It takes the libFuzzer options -runs, -seed and -max_len and
+ * ignores the others, so FUZZ_ARGS works with both builds.
+ * Usage: msgfuzz [-runs=N] [-seed=N] [-max_len=N] [file or directory ...]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+// the longest input read from a file or made up
+#define INPUT_MAX (1 << 16)
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+static uint8_t input[INPUT_MAX];
+/**
+ * Run the input read from one file. Returns 1 when it was run, 0 when it could not be read.
+ */
+int run_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+    size_t n = fread(input, 1, sizeof(input), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(input, n);
+    return 1;
+}
+/**
+ * Run one file, or every regular file of a directory. Returns the number of inputs run.
+ */
+int run_path(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return run_file(path);
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return 0;
+    }
+    struct dirent *entry;
+    char name[4096];
+    int ran = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+        if (stat(name, &st) == 0 && S_ISREG(st.st_mode)) {
+            ran += run_file(name);
+        }
+    }
+    closedir(dir);
+    return ran;
+}
+int main(int argc, char *argv[]) {
+    long runs = 100000, i;
+    unsigned int seed = 1;
+    size_t maxLen = 4096, n, k;
+    int a, replayed = 0;
+    for (a = 1; a < argc; a++) {
+        if (strncmp(argv[a], "-runs=", 6) == 0) {
+            runs = atol(argv[a] + 6);
+        } else if (strncmp(argv[a], "-seed=", 6) == 0) {
+            seed = (unsigned int)strtoul(argv[a] + 6, NULL, 10);
+        } else if (strncmp(argv[a], "-max_len=", 9) == 0) {
+            maxLen = strtoul(argv[a] + 9, NULL, 10);
+            maxLen = maxLen == 0 || maxLen > INPUT_MAX ? INPUT_MAX : maxLen;
+        } else if (argv[a][0] == '-') {
+            fprintf(stderr, "msgfuzz: ignoring %s, it needs libFuzzer\n", argv[a]);
+        } else {
+            replayed += run_path(argv[a]);
+        }
+    }
+    srand(seed);
+    for (i = 0; i < runs; i++) {
+        n = (size_t)rand() % (maxLen + 1);
+        for (k = 0; k < n; k++) {
+            input[k] = (uint8_t)rand();
+        }
+        LLVMFuzzerTestOneInput(input, n);
+    }
+    printf("msgfuzz: %d inputs replayed, %ld random inputs, seed %u, no failures\n", replayed, runs, seed);
+    return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * File: msgbench.c
+ * Author: Quan Nguyen
+ * Project:  Syscalls
+ * Class: CSC252
+ * Purpose: This is the benchmark of the message store, built in userspace from msgcore.c so it
+ * runs without booting the kernel. Sender threads go through the same steps as the send syscall
+ * (get the identity of the sender, find the mailbox, copy the text into a payload, queue the node) and
+ * receiver threads the same as csc452_get_msgs with CSC452_WAIT (take a batch, copy every
+ * message out, free the nodes). By default every receiver has its own mailbox and the senders
+ * are spread over them; with -same everybody shares one mailbox. It prints the throughput, the
+ * latency percentiles from the send timestamps of the nodes, and how often a mailbox lock was
+ * taken while somebody else had it.
+ * Usage: msgbench [-s senders] [-r receivers] [-n messagesPerSender] [-b bytes] [-same]
+ */
+#include "msgcore.h"
+#include <stdio.h>
+#include <sched.h>
+// the receivers take at most this many messages per call, like a csc452_get_msgs array
+#define BATCH 64
+// latency buckets: 16 for every power of two, so a percentile is off by 1/16 at most
+#define SUB_BUCKETS 16
+#define HISTOGRAM (64 * SUB_BUCKETS)
+/**
+ * What the threads share.
+ */
+typedef struct Bench {
+    int senders, receivers, same, bytes;
+    long count;
+    long remaining; // messages not received yet
+    long retries;   // sends that hit a quota and went again
+    pthread_barrier_t start;
+} Bench;
+/**
+ * One thread and its latency histogram in nanoseconds.
+ */
+typedef struct Worker {
+    Bench *bench;
+    int id;
+    pthread_t thread;
+    u64 histogram[HISTOGRAM];
+} Worker;
+// the uids of the mailboxes and the senders of the run, like real users well above root
+#define RECIPIENT_UID 10000
+#define SENDER_UID 20000
+/**
+ * Uid of the mailbox used by sender or receiver number i.
+ */
+kuid_t recipient(Bench *bench, int i) {
+    return KUIDT_INIT(RECIPIENT_UID + (bench->same ? 0 : i % bench->receivers));
+}
+/**
+ * The bucket of a latency of ns nanoseconds.
+ */
+int bucket(u64 ns) {
+    int shift;
+    if (ns < SUB_BUCKETS) {
+        return ns;
+    }
+    shift = fls64(ns) - 5;
+    return (shift + 1) * SUB_BUCKETS + ((ns >> shift) & (SUB_BUCKETS - 1));
+}
+/**
+ * The smallest latency in nanoseconds that falls into bucket i.
+ */
+u64 bucket_floor(int i) {
+    int shift = i / SUB_BUCKETS - 1;
+    if (shift < 0) {
+        return i;
+    }
+    return (u64)(SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+}
+/**
+ * Send count messages the way csc452_send_msg does. A message over a quota is sent again
+ * once the receivers made room.
+ */
+void *sender(void *arg) {
+    Worker *worker = arg;
+    Bench *bench = worker->bench;
+    kuid_t to = recipient(bench, worker->id), from = KUIDT_INIT(SENDER_UID + worker->id);
+    char text[CSC452_MSG_MAX];
+    long n, err;
+    memset(text, 'x', sizeof(text));
+    pthread_barrier_wait(&bench->start);
+    for (n = 0; n < bench->count; n++) {
+        for (;;) {
+            Mailbox *box = find_mailbox(to, true);
+            Payload *payload = alloc_payload(bench->bytes);
+            Identity *id = get_identity(from);
+            Node *node = payload != NULL && id != NULL ? new_node(id, payload, CSC452_PRIO_DEFAULT, 0) : NULL;
+            if (box == NULL || node == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            memcpy(payload->data, text, bench->bytes);
+            err = deliver_node(box, node);
+            put_mailbox(box);
+            if (err == 0) {
+                break;
+            }
+            __atomic_fetch_add(&bench->retries, 1, __ATOMIC_RELAXED);
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+/**
+ * Take messages the way csc452_get_msgs with CSC452_WAIT does until every message of the run
+ * came in, recording how long each one was queued.
+ */
+void *receiver(void *arg) {
+    Worker *worker = arg;
+    Bench *bench = worker->bench;
+    static __thread struct csc452_msg out[BATCH];
+    unsigned int more;
+    Mailbox *box = find_mailbox(recipient(bench, worker->id), true);
+    pthread_barrier_wait(&bench->start);
+    while (__atomic_load_n(&bench->remaining, __ATOMIC_RELAXED) > 0) {
+        LIST_HEAD(batch);
+        Node *temp, *next;
+        long taken, i = 0;
+        // wake up now and then to see whether the others got the last messages
+        taken = wait_messages(box, INVALID_UID, &batch, BATCH, &more, 10);
+        list_for_each_entry_safe(temp, next, &batch, list) {
+            memcpy(out[i].msg, temp->payload->data, temp->payload->len + 1);
+            out[i].from = __kuid_val(temp->from->uid);
+            out[i].len = temp->payload->len;
+            worker->histogram[bucket(ktime_get_ns() - temp->sent)]++;
+            list_del(&temp->list);
+            stat_received(temp);
+            free_node(temp);
+            i++;
+        }
+        if (taken > 0) {
+            wake_senders();
+            __atomic_fetch_sub(&bench->remaining, taken, __ATOMIC_RELAXED);
+        }
+    }
+    put_mailbox(box);
+    return NULL;
+}
+/**
+ * Print the latency at percentile p of the merged histogram.
+ */
+void percentile(const char *name, u64 *histogram, u64 total, double p) {
+    u64 seen = 0, want = (u64)(total * p);
+    int i;
+    for (i = 0; i < HISTOGRAM; i++) {
+        seen += histogram[i];
+        if (seen > want) {
+            break;
+        }
+    }
+    printf("  %s %10.1f us", name, bucket_floor(i) / 1000.0);
+}
+/**
+ * Main function for handling argument and print out the result.
+ */
+int main(int argc, char *argv[]) {
+    Bench bench = {.senders = 4, .receivers = 4, .count = 200000, .bytes = 64};
+    Worker *workers;
+    MsgReport report;
+    u64 histogram[HISTOGRAM] = {0}, total = 0;
+    struct timespec start, end;
+    int i, j, threads;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-same") == 0) {
+            bench.same = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            bench.senders = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+            bench.receivers = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            bench.count = atol(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-b") == 0) {
+            bench.bytes = atoi(argv[++i]);
+        } else {
+            bench.senders = -1;
+        }
+    }
+    if (bench.senders < 1 || bench.receivers < 1 || bench.count < 1 || bench.bytes < 0 ||
+        bench.bytes >= CSC452_MSG_MAX) {
+        printf("Usage: msgbench [-s senders] [-r receivers] [-n messagesPerSender] [-b bytes] [-same]\n");
+        return -1;
+    }
+    msgcore_init(NULL);
+    threads = bench.senders + bench.receivers;
+    bench.remaining = bench.senders * bench.count;
+    workers = calloc(threads, sizeof(Worker));
+    if (workers == NULL) {
+        return -1;
+    }
+    pthread_barrier_init(&bench.start, NULL, threads + 1);
+    for (i = 0; i < threads; i++) {
+        workers[i].bench = &bench;
+        workers[i].id = i < bench.senders ? i : i - bench.senders;
+        pthread_create(&workers[i].thread, NULL, i < bench.senders ? sender : receiver, &workers[i]);
+    }
+    pthread_barrier_wait(&bench.start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    for (i = 0; i < threads; i++) {
+        for (j = 0; j < HISTOGRAM; j++) {
+            histogram[j] += workers[i].histogram[j];
+            total += workers[i].histogram[j];
+        }
+    }
+    collect_stats(&report);
+    printf("%d senders, %d receivers, %s, %d byte messages\n", bench.senders, bench.receivers,
+           bench.same ? "one mailbox" : "one mailbox per receiver", bench.bytes);
+    printf("  %ld messages in %.3f s: %.0f messages/s, %.1f MB/s\n", bench.senders * bench.count,
+           elapsed, bench.senders * bench.count / elapsed,
+           bench.senders * bench.count * (double)bench.bytes / elapsed / 1e6);
+    percentile("p50", histogram, total, 0.50);
+    percentile("p99", histogram, total, 0.99);
+    percentile("p999", histogram, total, 0.999);
+    printf("\n  lock contended %.2f%%, quota retries %ld\n",
+           report.total.locked ? 100.0 * report.total.contended / report.total.locked : 0.0,
+           bench.retries);
+    free(workers);
+    return 0;
+}
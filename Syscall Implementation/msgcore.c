@@ -0,0 +1,1434 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  kernel/msgcore.c
+ *
+ *  The message store of the csc452 message syscalls, see msgcore.h.
+ */
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/stringhash.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/poll.h>
+#include <linux/capability.h>
+#endif
+#include "msgcore.h"
+#ifdef __KERNEL__
+#define CREATE_TRACE_POINTS
+#include "csc452_trace.h"
+#endif
+
+static struct kmem_cache *node_cache __read_mostly;
+// every sender identity, hashed by uid. Lookups run under RCU and only take
+// a reference; adding and removing take identities_lock.
+#define IDENTITY_HASH_BITS 8
+static DEFINE_HASHTABLE(identities, IDENTITY_HASH_BITS);
+static DEFINE_SPINLOCK(identities_lock);
+// attaching and detaching rings, so a mailbox gets at most one
+static DEFINE_MUTEX(rings_lock);
+// every group, hashed by name. Lookups run under RCU and only take a
+// reference; setting a group takes groups_lock.
+#define GROUP_HASH_BITS 6
+static DEFINE_HASHTABLE(groups, GROUP_HASH_BITS);
+static DEFINE_MUTEX(groups_lock);
+// every mailbox, hashed by the uid of its user. Lookups run under RCU and only
+// take a reference; adding and removing take mailboxes_lock.
+#define MAILBOX_HASH_BITS 10
+static DEFINE_HASHTABLE(mailboxes, MAILBOX_HASH_BITS);
+static DEFINE_SPINLOCK(mailboxes_lock);
+// the limits set through the kernel/csc452 sysctls, 0 means no limit. Bytes
+// count the node and the payload, which is what a message costs the kernel.
+unsigned int recipient_max_msgs = 1 << 20;
+unsigned long recipient_max_bytes = 256UL << 20;
+unsigned int sender_max_msgs = 1 << 20;
+unsigned long sender_max_bytes = 256UL << 20;
+// senders sleeping until a quota has room again
+static DECLARE_WAIT_QUEUE_HEAD(space_wait);
+// the hashed timer wheel of the queued messages with a TTL, and the last tick
+// expire_messages() finished, under expire_lock
+#define WHEEL_TICK_NS ((u64)WHEEL_TICK_MS * NSEC_PER_MSEC)
+static WheelSlot wheel[WHEEL_SLOTS];
+static u64 wheel_tick;
+// how many messages are in the timer wheel, and what to call when the first
+// one goes in, so the wheel is only turned while it has something to expire
+static atomic_t wheel_count;
+static void (*wheel_armed)(void);
+static DEFINE_MUTEX(expire_lock);
+static DEFINE_PER_CPU(MsgStats, msg_stats);
+// the ids of messages are handed to each CPU in batches of ID_BATCH, like
+// inode numbers in get_next_ino(), so numbering them shares no cache line
+#define ID_BATCH 1024
+#ifdef __KERNEL__
+static DEFINE_PER_CPU(u64, last_id);
+static atomic64_t shared_id;
+#else
+static u64 shared_id;
+#endif
+// count into the copy of this CPU; userspace has no real per-CPU data, so
+// threads sharing a slot add atomically
+#ifdef __KERNEL__
+#define count_stat(field, val) this_cpu_add(msg_stats.field, (val))
+#else
+#define count_stat(field, val) \
+	__atomic_fetch_add(&msg_stats[smp_processor_id()].field, (val), __ATOMIC_RELAXED)
+#endif
+/**
+ * Make the slab cache of message nodes and the timer wheel, before anyone can
+ * send. armed, when not NULL, is called whenever the wheel gets a message
+ * while it was empty, so the caller can start turning it.
+ */
+int __init msgcore_init(void (*armed)(void)) {
+	int i;
+	wheel_armed = armed;
+	node_cache = KMEM_CACHE(Node, SLAB_PANIC);
+	for (i = 0; i < WHEEL_SLOTS; i++) {
+		spin_lock_init(&wheel[i].lock);
+		INIT_LIST_HEAD(&wheel[i].nodes);
+	}
+	// no tick is over yet, not even the current one
+	wheel_tick = div_u64(ktime_get_ns(), WHEEL_TICK_NS) - 1;
+	return 0;
+}
+/**
+ * The id of a new message, never 0. Ids are unique but only increase on one
+ * CPU at a time.
+ */
+static u64 next_id(void) {
+#ifdef __KERNEL__
+	u64 *last = &get_cpu_var(last_id);
+	u64 id = *last;
+	if (unlikely(id % ID_BATCH == 0)) {
+		id = atomic64_add_return(ID_BATCH, &shared_id) - ID_BATCH;
+	}
+	*last = ++id;
+	put_cpu_var(last_id);
+	return id;
+#else
+	return __atomic_add_fetch(&shared_id, 1, __ATOMIC_RELAXED);
+#endif
+}
+/**
+ * Sleep like wait_event_interruptible_timeout() until condition or for at
+ * most remaining jiffies, for box, as a receiver or as a sender when
+ * sending, with a tracepoint when the sleep starts and one when it ends. How
+ * long it took is only measured while the second one is on.
+ */
+#define wait_traced(box, wq, condition, remaining, sending) ({			\
+	u64 __start = trace_csc452_msg_wake_enabled() ? ktime_get_ns() : 0;	\
+	long __ret;								\
+	trace_csc452_msg_block(box, remaining, sending);			\
+	__ret = wait_event_interruptible_timeout(wq, condition, remaining);	\
+	trace_csc452_msg_wake(box, __start != 0 ? ktime_get_ns() - __start : 0,	\
+			      __ret, sending);					\
+	__ret; })
+/**
+ * Look an identity up and take a reference on it. The caller holds
+ * rcu_read_lock() or identities_lock.
+ */
+static Identity *lookup_identity(kuid_t uid) {
+	Identity *id;
+	hash_for_each_possible_rcu(identities, id, hash, __kuid_val(uid)) {
+		if (uid_eq(id->uid, uid) && refcount_inc_not_zero(&id->refs)) {
+			return id;
+		}
+	}
+	return NULL;
+}
+/**
+ * Get the identity of a uid, making it when it is new. The caller owns one
+ * reference. Return NULL when out of memory.
+ */
+Identity *get_identity(kuid_t uid) {
+	Identity *id, *newId;
+	rcu_read_lock();
+	id = lookup_identity(uid);
+	rcu_read_unlock();
+	if (id != NULL) {
+		return id;
+	}
+	newId = kmalloc(sizeof(Identity), GFP_KERNEL);
+	if (newId == NULL) {
+		return NULL;
+	}
+	newId->uid = uid;
+	refcount_set(&newId->refs, 1);
+	atomic_set(&newId->count, 0);
+	atomic_long_set(&newId->bytes, 0);
+	spin_lock(&identities_lock);
+	id = lookup_identity(uid);
+	if (id == NULL) {
+		hash_add_rcu(identities, &newId->hash, __kuid_val(uid));
+		id = newId;
+		newId = NULL;
+	}
+	spin_unlock(&identities_lock);
+	kfree(newId);
+	return id;
+}
+/**
+ * Drop a reference on an identity, freeing it after a grace period when it
+ * was the last one.
+ */
+void put_identity(Identity *id) {
+	if (refcount_dec_and_lock(&id->refs, &identities_lock)) {
+		hash_del_rcu(&id->hash);
+		spin_unlock(&identities_lock);
+		kfree_rcu(id, rcu);
+	}
+}
+/**
+ * Allocate a payload for len bytes kept inline, the caller fills them in.
+ */
+Payload *alloc_payload(unsigned int len) {
+	Payload *payload = kmalloc(struct_size(payload, data, len + 1), GFP_KERNEL);
+	if (payload != NULL) {
+		refcount_set(&payload->refs, 1);
+		payload->data[len] = '\0';
+		payload->len = len;
+		payload->npages = 0;
+		payload->pages = NULL;
+	}
+	return payload;
+}
+/**
+ * Free the first count pages of a blob and the array of them.
+ */
+static void free_pages_of(Payload *payload, unsigned int count) {
+	while (count > 0) {
+		__free_page(payload->pages[--count]);
+	}
+	kvfree(payload->pages);
+}
+/**
+ * Allocate a blob payload for len bytes in separate pages, the caller fills
+ * them in. The end of the last page past len is zeroed, since the receiver
+ * maps whole pages.
+ */
+Payload *alloc_blob(unsigned int len) {
+	unsigned int npages = DIV_ROUND_UP(len, PAGE_SIZE), i;
+	Payload *payload = kmalloc(sizeof(Payload), GFP_KERNEL);
+	if (payload == NULL) {
+		return NULL;
+	}
+	payload->pages = kvmalloc_array(npages, sizeof(struct page *), GFP_KERNEL);
+	if (payload->pages == NULL) {
+		kfree(payload);
+		return NULL;
+	}
+	for (i = 0; i < npages; i++) {
+		payload->pages[i] = alloc_page(GFP_USER);
+		if (payload->pages[i] == NULL) {
+			free_pages_of(payload, i);
+			kfree(payload);
+			return NULL;
+		}
+	}
+	if (len % PAGE_SIZE != 0) {
+		memset((char *)page_address(payload->pages[npages - 1]) + len % PAGE_SIZE, 0,
+		       PAGE_SIZE - len % PAGE_SIZE);
+	}
+	refcount_set(&payload->refs, 1);
+	payload->len = len;
+	payload->npages = npages;
+	return payload;
+}
+/**
+ * Drop a reference on a payload, freeing it when it was the last one.
+ */
+void put_payload(Payload *payload) {
+	if (refcount_dec_and_test(&payload->refs)) {
+		if (payload->npages != 0) {
+			free_pages_of(payload, payload->npages);
+		}
+		kfree(payload);
+	}
+}
+/**
+ * Make a node for a message of priority prio that expires ttl milliseconds
+ * from now (never when 0), taking over the reference on from and the payload.
+ * A blob goes to the queue of blobs whatever its priority.
+ */
+Node *new_node(Identity *from, Payload *payload, unsigned int prio, unsigned int ttl) {
+	Node *node = kmem_cache_alloc(node_cache, GFP_KERNEL);
+	if (node == NULL) {
+		return NULL;
+	}
+	node->id = next_id();
+	node->from = from;
+	node->payload = payload;
+	node->sent = ktime_get_ns();
+	node->expires = ttl != 0 ? node->sent + (u64)ttl * NSEC_PER_MSEC : 0;
+	node->prio = payload->npages != 0 ? BLOB_QUEUE : prio;
+	node->box = NULL;
+	node->peer = NULL;
+	return node;
+}
+/**
+ * Drop a reference on a peer without holding the lock of its mailbox,
+ * taking it out of the mailbox and freeing it when it was the last one.
+ */
+static void put_peer(Peer *peer) {
+	Mailbox *box = peer->box;
+	if (refcount_dec_and_lock(&peer->refs, &box->lock)) {
+		hash_del(&peer->hash);
+		spin_unlock(&box->lock);
+		kfree(peer);
+	}
+}
+/**
+ * Free a node together with its payload and its references on the sender,
+ * its peer and the mailbox it was queued in. The caller must not hold the
+ * lock of the mailbox while the node still has a peer, see drop_peer(), nor
+ * when the node may hold the last reference on the mailbox.
+ */
+void free_node(Node *node) {
+	if (node->peer != NULL) {
+		put_peer(node->peer);
+	}
+	put_identity(node->from);
+	put_payload(node->payload);
+	if (node->box != NULL) {
+		put_mailbox(node->box);
+	}
+	kmem_cache_free(node_cache, node);
+}
+/**
+ * Look a mailbox up in the hash table and take a reference on it. The caller
+ * holds rcu_read_lock() or mailboxes_lock.
+ */
+static Mailbox *lookup_mailbox(kuid_t uid) {
+	Mailbox *box;
+	hash_for_each_possible_rcu(mailboxes, box, hash, __kuid_val(uid)) {
+		if (uid_eq(box->uid, uid) && refcount_inc_not_zero(&box->refs)) {
+			return box;
+		}
+	}
+	return NULL;
+}
+/**
+ * Find the mailbox of a uid in the hash table. When there is none yet and
+ * create is set, make an empty one. The caller owns one reference. Return
+ * NULL when there is no mailbox.
+ */
+Mailbox *find_mailbox(kuid_t uid, bool create) {
+	Mailbox *box, *newBox;
+	int i;
+	rcu_read_lock();
+	box = lookup_mailbox(uid);
+	rcu_read_unlock();
+	if (box != NULL || !create) {
+		return box;
+	}
+	newBox = kmalloc(sizeof(Mailbox), GFP_KERNEL);
+	if (newBox == NULL) {
+		return NULL;
+	}
+	newBox->uid = uid;
+	refcount_set(&newBox->refs, 1);
+	spin_lock_init(&newBox->lock);
+	for (i = 0; i <= BLOB_QUEUE; i++) {
+		INIT_LIST_HEAD(&newBox->queues[i]);
+	}
+	newBox->nonempty = 0;
+	newBox->count = 0;
+	newBox->blobs = 0;
+	newBox->bytes = 0;
+	hash_init(newBox->peers);
+	init_waitqueue_head(&newBox->wait);
+	newBox->ring = NULL;
+	// somebody else may have added it since the lookup
+	spin_lock(&mailboxes_lock);
+	box = lookup_mailbox(uid);
+	if (box == NULL) {
+		hash_add_rcu(mailboxes, &newBox->hash, __kuid_val(uid));
+		box = newBox;
+		newBox = NULL;
+	}
+	spin_unlock(&mailboxes_lock);
+	kfree(newBox);
+	return box;
+}
+/**
+ * Drop a reference on a mailbox, freeing it after a grace period when it was
+ * the last one. Nothing is queued there any more by then, and no peer or ring
+ * is left.
+ */
+void put_mailbox(Mailbox *box) {
+	if (refcount_dec_and_lock(&box->refs, &mailboxes_lock)) {
+		hash_del_rcu(&box->hash);
+		spin_unlock(&mailboxes_lock);
+		kfree_rcu(box, rcu);
+	}
+}
+/**
+ * The slot of the timer wheel for a message expiring at expires.
+ */
+static WheelSlot *wheel_slot(u64 expires) {
+	return &wheel[div_u64(expires, WHEEL_TICK_NS) & (WHEEL_SLOTS - 1)];
+}
+/**
+ * Put a message with a TTL into the timer wheel while it is queued. The
+ * caller holds the lock of its mailbox.
+ */
+static void wheel_add(Node *node) {
+	WheelSlot *slot;
+	if (node->expires == 0) {
+		return;
+	}
+	slot = wheel_slot(node->expires);
+	spin_lock(&slot->lock);
+	list_add_tail(&node->timer, &slot->nodes);
+	spin_unlock(&slot->lock);
+	if (atomic_inc_return(&wheel_count) == 1 && wheel_armed != NULL) {
+		wheel_armed();
+	}
+}
+/**
+ * Take a message out of the timer wheel when it leaves its mailbox. The
+ * caller holds the lock of the mailbox.
+ */
+static void wheel_del(Node *node) {
+	WheelSlot *slot;
+	if (node->expires == 0) {
+		return;
+	}
+	slot = wheel_slot(node->expires);
+	spin_lock(&slot->lock);
+	list_del(&node->timer);
+	spin_unlock(&slot->lock);
+	atomic_dec(&wheel_count);
+}
+/**
+ * Whether a message with a TTL is past it at now.
+ */
+static bool expired(Node *node, u64 now) {
+	return node->expires != 0 && node->expires <= now;
+}
+/**
+ * Take the lock of a mailbox, counting how often somebody else had it.
+ */
+static void lock_mailbox(Mailbox *box) {
+	count_stat(locked, 1);
+	if (!spin_trylock(&box->lock)) {
+		count_stat(contended, 1);
+		spin_lock(&box->lock);
+	}
+}
+/**
+ * Find the peer of a sender in a mailbox. The caller holds the lock of the
+ * mailbox.
+ */
+static Peer *lookup_peer(Mailbox *box, kuid_t uid) {
+	Peer *peer;
+	hash_for_each_possible(box->peers, peer, hash, __kuid_val(uid)) {
+		if (uid_eq(peer->uid, uid)) {
+			return peer;
+		}
+	}
+	return NULL;
+}
+/**
+ * Give a text node a reference on the peer of its sender in box before it is
+ * queued there, making the peer out of *spare when the sender has none yet.
+ * The caller holds the lock of the mailbox; without a spare it is dropped to
+ * allocate one and taken again, so what the caller checked under it has to
+ * be checked again. Return false when out of memory, with the lock held.
+ */
+static bool attach_peer(Mailbox *box, Node *node, Peer **spare) {
+	Peer *peer;
+	int i;
+	while (node->peer == NULL && node->prio != BLOB_QUEUE) {
+		peer = lookup_peer(box, node->from->uid);
+		if (peer != NULL) {
+			refcount_inc(&peer->refs);
+		} else if (*spare != NULL) {
+			peer = *spare;
+			*spare = NULL;
+			peer->uid = node->from->uid;
+			refcount_set(&peer->refs, 1);
+			peer->box = box;
+			for (i = 0; i < CSC452_PRIO_LEVELS; i++) {
+				INIT_LIST_HEAD(&peer->queues[i]);
+			}
+			peer->nonempty = 0;
+			peer->count = 0;
+			hash_add(box->peers, &peer->hash, __kuid_val(peer->uid));
+		} else {
+			spin_unlock(&box->lock);
+			*spare = kmalloc(sizeof(Peer), GFP_KERNEL);
+			lock_mailbox(box);
+			if (*spare == NULL) {
+				return false;
+			}
+			continue;
+		}
+		node->peer = peer;
+	}
+	return true;
+}
+/**
+ * Drop the reference of a node on its peer while holding the lock of the
+ * mailbox, before the node is freed under it.
+ */
+static void drop_peer(Node *node) {
+	Peer *peer = node->peer;
+	if (peer != NULL && refcount_dec_and_test(&peer->refs)) {
+		hash_del(&peer->hash);
+		kfree(peer);
+	}
+	node->peer = NULL;
+}
+/**
+ * Add a text message to the queue of its priority in its peer, at the head
+ * or at the tail. The caller holds the lock of the mailbox.
+ */
+static void peer_add(Node *node, bool head) {
+	Peer *peer = node->peer;
+	if (peer == NULL) {
+		return;
+	}
+	if (head) {
+		list_add(&node->sender, &peer->queues[node->prio]);
+	} else {
+		list_add_tail(&node->sender, &peer->queues[node->prio]);
+	}
+	__set_bit(node->prio, &peer->nonempty);
+	peer->count++;
+}
+/**
+ * Take a text message out of its peer. The caller holds the lock.
+ */
+static void peer_del(Node *node) {
+	Peer *peer = node->peer;
+	if (peer == NULL) {
+		return;
+	}
+	list_del(&node->sender);
+	if (list_empty(&peer->queues[node->prio])) {
+		__clear_bit(node->prio, &peer->nonempty);
+	}
+	peer->count--;
+}
+/**
+ * Make box the mailbox of a node the first time it is queued, taking the
+ * reference it keeps until it is freed. A node given back keeps the one it
+ * has.
+ */
+static void hold_mailbox(Mailbox *box, Node *node) {
+	if (node->box == NULL) {
+		refcount_inc(&box->refs);
+		node->box = box;
+	}
+}
+/**
+ * Add a message at the tail of the queue of its priority. The caller holds
+ * the lock of the mailbox.
+ */
+static void queue_message(Mailbox *box, Node *node) {
+	hold_mailbox(box, node);
+	list_add_tail(&node->list, &box->queues[node->prio]);
+	__set_bit(node->prio, &box->nonempty);
+	peer_add(node, false);
+	wheel_add(node);
+	trace_csc452_msg_enqueue(box, node);
+}
+/**
+ * Put a message that was taken out back at the head of the queue of its
+ * priority, so it comes out next again. The caller holds the lock.
+ */
+static void requeue_message(Mailbox *box, Node *node) {
+	hold_mailbox(box, node);
+	list_add(&node->list, &box->queues[node->prio]);
+	__set_bit(node->prio, &box->nonempty);
+	peer_add(node, true);
+	wheel_add(node);
+}
+/**
+ * Get the oldest message of the most urgent priority that has one, or NULL
+ * when the mailbox is empty. The caller holds the lock.
+ */
+static Node *first_message(Mailbox *box) {
+	unsigned int prio = find_first_bit(&box->nonempty, CSC452_PRIO_LEVELS);
+	if (prio >= CSC452_PRIO_LEVELS) {
+		return NULL;
+	}
+	return list_first_entry(&box->queues[prio], Node, list);
+}
+/**
+ * Unlink a message from the queue of its priority and from its peer. The
+ * caller holds the lock.
+ */
+static void unlink_message(Mailbox *box, Node *node) {
+	list_del(&node->list);
+	if (list_empty(&box->queues[node->prio])) {
+		__clear_bit(node->prio, &box->nonempty);
+	}
+	peer_del(node);
+}
+/**
+ * Take a message off its queue and out of the timer wheel. The caller holds
+ * the lock.
+ */
+static void unqueue_message(Mailbox *box, Node *node) {
+	unlink_message(box, node);
+	wheel_del(node);
+}
+/**
+ * Wake the receivers sleeping on a mailbox after messages were added to it.
+ * Checking for sleepers first keeps the send path free of the wait queue
+ * lock when nobody waits.
+ */
+static void wake_receivers(Mailbox *box) {
+	if (wq_has_sleeper(&box->wait)) {
+		wake_up_interruptible_poll(&box->wait, EPOLLIN | EPOLLRDNORM);
+	}
+}
+/**
+ * What a queued message costs the kernel, for the byte quotas.
+ */
+static unsigned long node_cost(Node *node) {
+	Payload *payload = node->payload;
+	if (payload->npages != 0) {
+		return sizeof(Node) + sizeof(Payload) +
+		       payload->npages * (PAGE_SIZE + sizeof(struct page *));
+	}
+	return sizeof(Node) + struct_size(payload, data, payload->len + 1);
+}
+/**
+ * Check a value against a limit, where a limit of 0 means none.
+ */
+static bool over_limit(unsigned long value, unsigned long limit) {
+	return limit != 0 && value > limit;
+}
+/**
+ * Check whether queueing node in box would go over a quota of the recipient
+ * or of the sender. The caller holds the lock of the mailbox, so the mailbox
+ * counts are exact; a sender filling several mailboxes at once can go over
+ * its own limit by the messages it has in flight.
+ */
+static bool over_quota(Mailbox *box, Node *node) {
+	unsigned long cost = node_cost(node);
+	return over_limit(READ_ONCE(box->count) + 1, READ_ONCE(recipient_max_msgs)) ||
+	       over_limit(READ_ONCE(box->bytes) + cost, READ_ONCE(recipient_max_bytes)) ||
+	       over_limit(atomic_read(&node->from->count) + 1, READ_ONCE(sender_max_msgs)) ||
+	       over_limit(atomic_long_read(&node->from->bytes) + cost,
+			  READ_ONCE(sender_max_bytes));
+}
+/**
+ * Add a message to the counts of its mailbox and its sender when sign is 1,
+ * take it away when sign is -1. Every path that puts a node in a mailbox or
+ * takes one out calls this under the lock of the mailbox, so it is O(1).
+ */
+static void account(Mailbox *box, Node *node, int sign) {
+	long cost = sign * (long)node_cost(node);
+	WRITE_ONCE(box->count, box->count + sign);
+	WRITE_ONCE(box->bytes, box->bytes + cost);
+	if (node->prio == BLOB_QUEUE) {
+		box->blobs += sign;
+	}
+	atomic_add(sign, &node->from->count);
+	atomic_long_add(cost, &node->from->bytes);
+}
+/**
+ * Wake the senders waiting for room after messages left a mailbox.
+ */
+void wake_senders(void) {
+	if (wq_has_sleeper(&space_wait)) {
+		wake_up_interruptible(&space_wait);
+	}
+}
+/**
+ * Count a message that was queued.
+ */
+static void stat_sent(Node *node) {
+	count_stat(sent, 1);
+	count_stat(sentBytes, node->payload->len);
+}
+/**
+ * Count and trace a message that reached its receiver, and how long that
+ * took.
+ */
+void stat_received(Node *node) {
+	u64 waited = ktime_get_ns() - node->sent, us = div_u64(waited, NSEC_PER_USEC);
+	trace_csc452_msg_dequeue(node, waited);
+	count_stat(received, 1);
+	count_stat(receivedBytes, node->payload->len);
+	count_stat(latency[min_t(unsigned int, fls64(us), LATENCY_BUCKETS - 1)], 1);
+}
+/**
+ * Free the messages that expired before anyone got them, and wake the senders
+ * waiting for the room they took. Return how many there were.
+ */
+static unsigned int free_expired(struct list_head *dead) {
+	Node *temp, *next;
+	unsigned int count = 0;
+	list_for_each_entry_safe(temp, next, dead, list) {
+		list_del(&temp->list);
+		free_node(temp);
+		count++;
+	}
+	if (count > 0) {
+		count_stat(expired, count);
+		wake_senders();
+	}
+	return count;
+}
+/**
+ * Move queued messages of a mailbox into its ring while there are free slots,
+ * most urgent first. Messages only wait in the queues while the ring is full.
+ * The caller holds the lock of the mailbox.
+ */
+static void ring_deliver(Mailbox *box) {
+	Ring *ring = box->ring;
+	Node *temp;
+	u64 now;
+	u32 head;
+	if (ring == NULL) {
+		return;
+	}
+	head = ring->head;
+	now = ktime_get_ns();
+	while ((temp = first_message(box)) != NULL) {
+		unsigned int index = ring->head & (CSC452_RING_SLOTS - 1);
+		struct csc452_msg *slot = &ring->shared->slot[index];
+		// what expired on its way is dropped instead of taking a slot
+		if (expired(temp, now)) {
+			unqueue_message(box, temp);
+			account(box, temp, -1);
+			drop_peer(temp);
+			free_node(temp);
+			count_stat(expired, 1);
+			continue;
+		}
+		// the tail comes from userspace, a bad one only stops the delivery
+		if (ring->head - smp_load_acquire(&ring->shared->tail) >= CSC452_RING_SLOTS) {
+			break;
+		}
+		memcpy(slot->msg, temp->payload->data, temp->payload->len + 1);
+		slot->len = temp->payload->len;
+		slot->from = from_kuid_munged(ring->ns, temp->from->uid);
+		ring->from[index] = temp->from->uid;
+		WRITE_ONCE(ring->head, ring->head + 1);
+		unqueue_message(box, temp);
+		// the ring is already paid for, so the message leaves the quotas
+		account(box, temp, -1);
+		stat_received(temp);
+		drop_peer(temp);
+		free_node(temp);
+	}
+	if (ring->head != head) {
+		smp_store_release(&ring->shared->head, ring->head);
+		wake_senders();
+	}
+}
+/**
+ * Queue one node in a mailbox and wake its receivers. When that would go over
+ * a quota the node is freed and -EAGAIN returned, -ENOMEM when its sender
+ * could not get a peer there.
+ */
+long deliver_node(Mailbox *box, Node *node) {
+	Peer *spare = NULL;
+	long err = 0;
+	lock_mailbox(box);
+	if (!attach_peer(box, node, &spare)) {
+		spin_unlock(&box->lock);
+		free_node(node);
+		err = -ENOMEM;
+		goto out;
+	}
+	if (over_quota(box, node)) {
+		spin_unlock(&box->lock);
+		free_node(node);
+		count_stat(rejected, 1);
+		err = -EAGAIN;
+		goto out;
+	}
+	account(box, node, 1);
+	stat_sent(node);
+	queue_message(box, node);
+	ring_deliver(box);
+	spin_unlock(&box->lock);
+	wake_receivers(box);
+out:
+	// somebody else made the peer while the lock was dropped
+	kfree(spare);
+	return err;
+}
+/**
+ * Order pending entries by mailbox, then by their place in the array.
+ */
+static int compare_pending(const void *a, const void *b) {
+	const Pending *x = a, *y = b;
+	if (x->box != y->box) {
+		return x->box < y->box ? -1 : 1;
+	}
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+/**
+ * Queue the ready nodes of a vectored send. They are grouped by mailbox so
+ * each mailbox lock is taken once for the whole batch. A node that would go
+ * over a quota is freed with -EAGAIN in its status, or with CSC452_WAIT in
+ * flags the caller sleeps until there is room. Return how many were queued.
+ */
+unsigned int deliver_pending(Pending *pending, unsigned int ready, unsigned int flags) {
+	unsigned int i, j, queued = ready;
+	bool interrupted = false;
+	Peer *spare = NULL;
+	sort(pending, ready, sizeof(*pending), compare_pending, NULL);
+	for (i = 0; i < ready; i = j) {
+		Mailbox *box = pending[i].box;
+		lock_mailbox(box);
+		for (j = i; j < ready && pending[j].box == box; j++) {
+			Node *newNode = pending[j].node;
+			if (!attach_peer(box, newNode, &spare)) {
+				pending[j].status = -ENOMEM;
+				free_node(newNode);
+				queued--;
+				continue;
+			}
+			while (!interrupted && (flags & CSC452_WAIT) && over_quota(box, newNode)) {
+				// let the receivers at what is queued so far, then wait for room
+				ring_deliver(box);
+				spin_unlock(&box->lock);
+				wake_receivers(box);
+				if (wait_traced(box, space_wait, !over_quota(box, newNode),
+						MAX_SCHEDULE_TIMEOUT, true) < 0) {
+					interrupted = true;
+				}
+				lock_mailbox(box);
+			}
+			if (over_quota(box, newNode)) {
+				pending[j].status = interrupted ? -EINTR : -EAGAIN;
+				drop_peer(newNode);
+				free_node(newNode);
+				count_stat(rejected, 1);
+				queued--;
+				continue;
+			}
+			pending[j].status = 0;
+			account(box, newNode, 1);
+			stat_sent(newNode);
+			queue_message(box, newNode);
+		}
+		ring_deliver(box);
+		spin_unlock(&box->lock);
+		wake_receivers(box);
+	}
+	kfree(spare);
+	return queued;
+}
+/**
+ * Take up to max messages of one sender off a mailbox into batch through its
+ * peer, most urgent first, one by one since they are spread over the queues
+ * of the mailbox. Messages past their TTL go onto dead instead. The caller
+ * holds the lock. Return how many were taken.
+ */
+static unsigned int take_from(Mailbox *box, Peer *peer, struct list_head *batch,
+			      unsigned int max, u64 now, struct list_head *dead) {
+	unsigned int taken = 0, prio;
+	Node *temp;
+	while (taken < max &&
+	       (prio = find_first_bit(&peer->nonempty, CSC452_PRIO_LEVELS)) < CSC452_PRIO_LEVELS) {
+		temp = list_first_entry(&peer->queues[prio], Node, sender);
+		unqueue_message(box, temp);
+		account(box, temp, -1);
+		if (expired(temp, now)) {
+			list_add_tail(&temp->list, dead);
+			continue;
+		}
+		list_add_tail(&temp->list, batch);
+		taken++;
+	}
+	return taken;
+}
+/**
+ * Cut up to max messages off a mailbox into batch, most urgent first and the
+ * oldest first within a priority. Every queue is cut in one piece. When from
+ * is a valid uid only the messages of that sender are taken, through its
+ * peer. Messages past their TTL are dropped on the way instead of being
+ * taken. Return how many were taken; *more tells whether the mailbox still
+ * has messages, from that sender when there is one.
+ */
+unsigned int take_messages(Mailbox *box, kuid_t from, struct list_head *batch,
+			   unsigned int max, unsigned int *more) {
+	unsigned int taken = 0, prio;
+	u64 now = ktime_get_ns();
+	Node *temp, *next;
+	Peer *peer;
+	LIST_HEAD(dead);
+	lock_mailbox(box);
+	if (uid_valid(from)) {
+		peer = lookup_peer(box, from);
+		// the peer stays while the nodes taken from it hold it
+		taken = peer != NULL ? take_from(box, peer, batch, max, now, &dead) : 0;
+		*more = peer != NULL && peer->nonempty != 0;
+		spin_unlock(&box->lock);
+		free_expired(&dead);
+		return taken;
+	}
+	while (taken < max &&
+	       (prio = find_first_bit(&box->nonempty, CSC452_PRIO_LEVELS)) < CSC452_PRIO_LEVELS) {
+		struct list_head *queue = &box->queues[prio];
+		LIST_HEAD(part);
+		list_for_each_entry_safe(temp, next, queue, list) {
+			account(box, temp, -1);
+			wheel_del(temp);
+			peer_del(temp);
+			if (expired(temp, now)) {
+				list_move_tail(&temp->list, &dead);
+				continue;
+			}
+			if (++taken == max) {
+				break;
+			}
+		}
+		list_cut_position(&part, queue, taken == max ? &temp->list : queue->prev);
+		list_splice_tail(&part, batch);
+		if (list_empty(queue)) {
+			__clear_bit(prio, &box->nonempty);
+		}
+	}
+	*more = (box->nonempty & TEXT_QUEUES) != 0;
+	spin_unlock(&box->lock);
+	free_expired(&dead);
+	return taken;
+}
+/**
+ * Whether a mailbox has messages, from the uid from when it is valid. Only
+ * the filtered check needs the lock, to find the peer.
+ */
+static bool has_messages(Mailbox *box, kuid_t from) {
+	if (uid_valid(from)) {
+		return count_messages(box, from) > 0;
+	}
+	return (READ_ONCE(box->nonempty) & TEXT_QUEUES) != 0;
+}
+/**
+ * Like take_messages(), but an empty mailbox puts the caller to sleep on the
+ * wait queue of the mailbox until a message is sent to it, for at most
+ * timeout milliseconds (forever when timeout is negative). Return how many
+ * were taken, 0 when the wait timed out, or -EINTR when a signal came first.
+ */
+long wait_messages(Mailbox *box, kuid_t from, struct list_head *batch, unsigned int max,
+		   unsigned int *more, long timeout) {
+	long remaining = timeout < 0 ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(timeout);
+	unsigned int taken;
+	for (;;) {
+		taken = take_messages(box, from, batch, max, more);
+		if (taken > 0 || remaining == 0) {
+			return taken;
+		}
+		remaining = wait_traced(box, box->wait, has_messages(box, from), remaining,
+					false);
+		if (remaining < 0) {
+			return -EINTR;
+		}
+	}
+}
+/**
+ * Look at up to max messages of a mailbox, or only at those from the uid from
+ * when it is valid, in the order take_messages() would take them, but leave
+ * them queued. peek gets a reference on the sender and the payload of each,
+ * so they stay valid after the lock is dropped. Messages past their TTL met
+ * on the way are reclaimed like take_messages() does, so no later peek walks
+ * over them again, and the walk stops once every queued message was looked
+ * at. Return how many were seen; *more tells whether there are more that
+ * have not expired, found by looking on up to the next one.
+ */
+unsigned int peek_messages(Mailbox *box, kuid_t from, Peek *peek, unsigned int max,
+			   unsigned int *more) {
+	unsigned int seen = 0, left, prio;
+	u64 now = ktime_get_ns();
+	struct list_head *pos, *next;
+	Peer *peer = NULL;
+	LIST_HEAD(dead);
+	lock_mailbox(box);
+	if (uid_valid(from)) {
+		peer = lookup_peer(box, from);
+		left = peer != NULL ? peer->count : 0;
+	} else {
+		left = box->count - box->blobs;
+	}
+	*more = 0;
+	for (prio = 0; prio < CSC452_PRIO_LEVELS && left > 0 && !*more; prio++) {
+		struct list_head *queue = peer != NULL ? &peer->queues[prio] : &box->queues[prio];
+		list_for_each_safe(pos, next, queue) {
+			Node *temp = peer != NULL ? list_entry(pos, Node, sender) :
+				     list_entry(pos, Node, list);
+			if (left == 0) {
+				break;
+			}
+			left--;
+			if (expired(temp, now)) {
+				unqueue_message(box, temp);
+				account(box, temp, -1);
+				list_add_tail(&temp->list, &dead);
+				continue;
+			}
+			if (seen == max) {
+				*more = 1;
+				break;
+			}
+			refcount_inc(&temp->from->refs);
+			refcount_inc(&temp->payload->refs);
+			peek[seen].from = temp->from;
+			peek[seen].payload = temp->payload;
+			seen++;
+		}
+	}
+	spin_unlock(&box->lock);
+	free_expired(&dead);
+	return seen;
+}
+/**
+ * How many text messages a mailbox holds, or how many from the uid from when
+ * it is valid, in O(1). Messages past their TTL that were not reclaimed yet
+ * are still counted.
+ */
+unsigned int count_messages(Mailbox *box, kuid_t from) {
+	unsigned int count;
+	Peer *peer;
+	lock_mailbox(box);
+	if (uid_valid(from)) {
+		peer = lookup_peer(box, from);
+		count = peer != NULL ? peer->count : 0;
+	} else {
+		count = box->count - box->blobs;
+	}
+	spin_unlock(&box->lock);
+	return count;
+}
+/**
+ * Sleep until a mailbox has messages, from the uid from when it is valid, for
+ * at most timeout milliseconds (forever when negative), without taking any.
+ * Return 1 when there are, 0 when the wait timed out, or -EINTR when a signal
+ * came first.
+ */
+long wait_ready(Mailbox *box, kuid_t from, long timeout) {
+	long remaining = timeout < 0 ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(timeout);
+	remaining = wait_traced(box, box->wait, has_messages(box, from), remaining, false);
+	if (remaining < 0) {
+		return -EINTR;
+	}
+	return remaining > 0;
+}
+/**
+ * Take the oldest blob of a mailbox into batch. With a timeout that is not 0
+ * an empty queue of blobs puts the caller to sleep until one comes, for at
+ * most timeout milliseconds (forever when negative). Return 1 when a blob
+ * was taken, 0 when there was none, or -EINTR when a signal came first.
+ */
+long take_blob(Mailbox *box, struct list_head *batch, long timeout) {
+	long remaining = timeout < 0 ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(timeout);
+	u64 now;
+	Node *temp;
+	LIST_HEAD(dead);
+	for (;;) {
+		now = ktime_get_ns();
+		lock_mailbox(box);
+		while (!list_empty(&box->queues[BLOB_QUEUE])) {
+			temp = list_first_entry(&box->queues[BLOB_QUEUE], Node, list);
+			unqueue_message(box, temp);
+			account(box, temp, -1);
+			if (!expired(temp, now)) {
+				list_add_tail(&temp->list, batch);
+				break;
+			}
+			list_add_tail(&temp->list, &dead);
+		}
+		spin_unlock(&box->lock);
+		free_expired(&dead);
+		if (!list_empty(batch) || remaining == 0) {
+			return !list_empty(batch);
+		}
+		remaining = wait_traced(box, box->wait, has_blobs(box), remaining, false);
+		if (remaining < 0) {
+			return -EINTR;
+		}
+	}
+}
+/**
+ * Whether a mailbox has blobs waiting, without taking its lock.
+ */
+bool has_blobs(Mailbox *box) {
+	return test_bit(BLOB_QUEUE, &box->nonempty);
+}
+/**
+ * Give back taken messages the receiver could not get, at the heads of their
+ * queues and last first so each queue keeps its order.
+ */
+void return_messages(Mailbox *box, struct list_head *batch) {
+	Node *temp, *next;
+	lock_mailbox(box);
+	list_for_each_entry_safe_reverse(temp, next, batch, list) {
+		account(box, temp, 1);
+		list_del(&temp->list);
+		requeue_message(box, temp);
+	}
+	spin_unlock(&box->lock);
+}
+/**
+ * How many slots of a ring hold messages the receiver has not read yet.
+ */
+u32 ring_ready(Ring *ring) {
+	u32 ready = READ_ONCE(ring->head) - READ_ONCE(ring->shared->tail);
+	return ready > CSC452_RING_SLOTS ? 0 : ready;
+}
+/**
+ * Take the ring off its mailbox. The messages the receiver never read are
+ * turned back into nodes at the head of the mailbox, so closing the ring
+ * loses nothing. The caller holds rings_lock.
+ */
+static void ring_detach(Ring *ring) {
+	Mailbox *box = ring->box;
+	LIST_HEAD(unread);
+	Node *node, *next;
+	Peer *spare = NULL;
+	u32 tail;
+	lock_mailbox(box);
+	box->ring = NULL;
+	spin_unlock(&box->lock);
+	tail = ring->head - ring_ready(ring);
+	for (; tail != ring->head; tail++) {
+		unsigned int index = tail & (CSC452_RING_SLOTS - 1);
+		struct csc452_msg *slot = &ring->shared->slot[index];
+		Payload *payload;
+		Identity *id;
+		// the slot is still mapped, the sender comes from the copy of the kernel
+		payload = alloc_payload(min_t(u32, READ_ONCE(slot->len), CSC452_INLINE_MAX));
+		id = get_identity(ring->from[index]);
+		// the most urgent priority keeps them ahead of everything still queued,
+		// and having reached the receiver once they no longer expire
+		node = payload != NULL && id != NULL ? new_node(id, payload, 0, 0) : NULL;
+		if (node == NULL) {
+			if (id != NULL) {
+				put_identity(id);
+			}
+			if (payload != NULL) {
+				put_payload(payload);
+			}
+			break;
+		}
+		memcpy(payload->data, slot->msg, payload->len);
+		list_add_tail(&node->list, &unread);
+	}
+	// they were paid for once already, so they go back even over a quota,
+	// last first at the head so they keep their order
+	lock_mailbox(box);
+	list_for_each_entry_safe_reverse(node, next, &unread, list) {
+		list_del(&node->list);
+		if (!attach_peer(box, node, &spare)) {
+			free_node(node);
+			continue;
+		}
+		account(box, node, 1);
+		requeue_message(box, node);
+	}
+	spin_unlock(&box->lock);
+	kfree(spare);
+	ring->box = NULL;
+	put_mailbox(box);
+}
+/**
+ * Make ring the one of box. Messages already queued there move into the ring
+ * right away. The ring takes over the reference of the caller on box until it
+ * is detached. Return -EBUSY when either already has one, and the caller
+ * keeps its reference.
+ */
+long attach_ring(Ring *ring, Mailbox *box) {
+	long err = 0;
+	mutex_lock(&rings_lock);
+	if (ring->box != NULL || box->ring != NULL) {
+		err = -EBUSY;
+	} else {
+		ring->box = box;
+		lock_mailbox(box);
+		box->ring = ring;
+		ring_deliver(box);
+		spin_unlock(&box->lock);
+	}
+	mutex_unlock(&rings_lock);
+	return err;
+}
+/**
+ * Take a ring off its mailbox when it is attached to one.
+ */
+void detach_ring(Ring *ring) {
+	mutex_lock(&rings_lock);
+	if (ring->box != NULL) {
+		ring_detach(ring);
+	}
+	mutex_unlock(&rings_lock);
+}
+/**
+ * Sleep until the ring has messages to read, for at most timeout milliseconds
+ * (forever when negative). Return how many slots are ready, 0 when the wait
+ * timed out, or -EINTR when a signal came first.
+ */
+long ring_wait(Ring *ring, long timeout) {
+	Mailbox *box = ring->box;
+	long remaining = timeout < 0 ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(timeout);
+	u32 ready;
+	if (box == NULL) {
+		return -EINVAL;
+	}
+	for (;;) {
+		// slots the receiver freed can take what waited in the list
+		lock_mailbox(box);
+		ring_deliver(box);
+		spin_unlock(&box->lock);
+		ready = ring_ready(ring);
+		if (ready > 0 || remaining == 0) {
+			return ready;
+		}
+		remaining = wait_traced(box, box->wait, ring_ready(ring) > 0, remaining, false);
+		if (remaining < 0) {
+			return -EINTR;
+		}
+	}
+}
+/**
+ * Take the expired messages of one slot of the timer wheel out of their
+ * mailboxes and onto dead, leaving the ones of a later turn. The lock of a
+ * mailbox comes before the lock of a slot, so here it is only tried; return
+ * false when one was busy and the slot has to be looked at again.
+ */
+static bool expire_slot(WheelSlot *slot, u64 now, struct list_head *dead) {
+	Node *temp, *next;
+	bool done = true;
+	spin_lock(&slot->lock);
+	list_for_each_entry_safe(temp, next, &slot->nodes, timer) {
+		Mailbox *box = temp->box;
+		if (!expired(temp, now)) {
+			continue;
+		}
+		if (!spin_trylock(&box->lock)) {
+			done = false;
+			continue;
+		}
+		list_del(&temp->timer);
+		atomic_dec(&wheel_count);
+		unlink_message(box, temp);
+		account(box, temp, -1);
+		spin_unlock(&box->lock);
+		list_add_tail(&temp->list, dead);
+	}
+	spin_unlock(&slot->lock);
+	return done;
+}
+/**
+ * Turn the timer wheel up to now: reclaim the expired messages of the slots
+ * of every tick that is over since the last call, so messages nobody
+ * receives do not stay forever and no call has to walk the whole store. The
+ * kernel calls this every WHEEL_TICK_MS. Return how many messages expired.
+ */
+unsigned int expire_messages(void) {
+	u64 now = ktime_get_ns(), tick = div_u64(now, WHEEL_TICK_NS);
+	LIST_HEAD(dead);
+	mutex_lock(&expire_lock);
+	// after a long pause every slot still gets looked at only once
+	if (tick - wheel_tick > WHEEL_SLOTS) {
+		wheel_tick = tick - WHEEL_SLOTS;
+	}
+	// the current tick is not over, so its slot waits for the next call
+	while (wheel_tick + 1 < tick &&
+	       expire_slot(&wheel[(wheel_tick + 1) & (WHEEL_SLOTS - 1)], now, &dead)) {
+		wheel_tick++;
+	}
+	mutex_unlock(&expire_lock);
+	return free_expired(&dead);
+}
+/**
+ * Whether the timer wheel still holds messages, so it has to be turned again.
+ */
+bool wheel_pending(void) {
+	return atomic_read(&wheel_count) != 0;
+}
+/**
+ * How many messages a mailbox holds, in the list and in the ring together.
+ */
+u64 mailbox_depth(Mailbox *box) {
+	u64 depth;
+	lock_mailbox(box);
+	depth = box->count;
+	if (box->ring != NULL) {
+		depth += ring_ready(box->ring);
+	}
+	spin_unlock(&box->lock);
+	return depth;
+}
+/**
+ * Look a group up and take a reference on it. The caller holds
+ * rcu_read_lock().
+ */
+static Group *lookup_group(const char *name, unsigned int key) {
+	Group *group;
+	hash_for_each_possible_rcu(groups, group, hash, key) {
+		if (strcmp(group->name, name) == 0 && refcount_inc_not_zero(&group->refs)) {
+			return group;
+		}
+	}
+	return NULL;
+}
+/**
+ * Find a group by name and take a reference on it. Return NULL when there is
+ * no such group.
+ */
+Group *find_group(const char *name, long len) {
+	Group *group;
+	rcu_read_lock();
+	group = lookup_group(name, full_name_hash(NULL, name, len));
+	rcu_read_unlock();
+	return group;
+}
+/**
+ * Drop a reference on a group, freeing it after a grace period when it was
+ * the last one. It is out of the hash table by then.
+ */
+void put_group(Group *group) {
+	if (refcount_dec_and_test(&group->refs)) {
+		kvfree_rcu(group, rcu);
+	}
+}
+/**
+ * Sort the members of a group by uid.
+ */
+static int compare_member(const void *a, const void *b) {
+	u32 x = __kuid_val(*(const kuid_t *)a), y = __kuid_val(*(const kuid_t *)b);
+	return x < y ? -1 : x > y;
+}
+/**
+ * Make group the group called name for the user uid, replacing what it was.
+ * group comes from kvmalloc() with its count and members filled in, and is
+ * taken over; a NULL group deletes the old one. A new group belongs to uid,
+ * a replaced one keeps its owner. Return 0, -EPERM when the old group
+ * belongs to somebody else and uid is not an admin, or -ENOENT when there
+ * was nothing to delete.
+ */
+long replace_group(const char *name, long len, Group *group, kuid_t uid) {
+	unsigned int key = full_name_hash(NULL, name, len), i, unique = 0;
+	Group *old;
+	long err = 0;
+	if (group != NULL) {
+		// a user listed twice still gets one copy
+		sort(group->members, group->count, sizeof(kuid_t), compare_member, NULL);
+		for (i = 0; i < group->count; i++) {
+			if (unique == 0 || !uid_eq(group->members[unique - 1], group->members[i])) {
+				group->members[unique++] = group->members[i];
+			}
+		}
+		strcpy(group->name, name);
+		refcount_set(&group->refs, 1);
+		group->owner = uid;
+		group->count = unique;
+	}
+	mutex_lock(&groups_lock);
+	rcu_read_lock();
+	old = lookup_group(name, key);
+	rcu_read_unlock();
+	if (old != NULL && !uid_eq(old->owner, uid) && !capable(CAP_SYS_ADMIN)) {
+		put_group(old);
+		kvfree(group);
+		err = -EPERM;
+	} else if (old != NULL) {
+		// one reference from the lookup, one of the table
+		if (group != NULL) {
+			group->owner = old->owner;
+			hlist_replace_rcu(&old->hash, &group->hash);
+		} else {
+			hash_del_rcu(&old->hash);
+		}
+		put_group(old);
+		put_group(old);
+	} else if (group != NULL) {
+		hash_add_rcu(groups, &group->hash, key);
+	} else {
+		err = -ENOENT;
+	}
+	mutex_unlock(&groups_lock);
+	return err;
+}
+/**
+ * Queue one message for every member of a group, expiring ttl milliseconds
+ * from now (never when 0), every node pointing at the same payload and
+ * taking its own references on it and on id. The mailbox of a member is
+ * made here when it has none yet, like for any other send. A member whose
+ * quota is full is skipped. Return how many members the message was queued
+ * for, or when that is none the error of the last one, -EAGAIN when they
+ * were all over a quota.
+ */
+long broadcast_message(Group *group, Identity *id, Payload *payload, unsigned int prio,
+		       unsigned int ttl) {
+	long queued = 0, err = 0, ret;
+	unsigned int i;
+	for (i = 0; i < group->count; i++) {
+		Mailbox *box = find_mailbox(group->members[i], true);
+		Node *newNode = box != NULL ? new_node(id, payload, prio, ttl) : NULL;
+		if (newNode == NULL) {
+			if (box != NULL) {
+				put_mailbox(box);
+			}
+			err = -ENOMEM;
+			break;
+		}
+		// every node owns a reference on both
+		refcount_inc(&id->refs);
+		refcount_inc(&payload->refs);
+		ret = deliver_node(box, newNode);
+		put_mailbox(box);
+		if (ret == 0) {
+			queued++;
+		} else {
+			err = ret;
+		}
+	}
+	return queued > 0 ? queued : err;
+}
+/**
+ * Add up the counters of every CPU and walk over every mailbox for the depth
+ * histogram, the bytes pinned and the deepest recipients. The walk reads the
+ * counts without locks, so it is a snapshot that may be off by the messages
+ * in flight.
+ */
+void collect_stats(MsgReport *report) {
+	Mailbox *box;
+	int cpu, i, bkt;
+	memset(report, 0, sizeof(*report));
+	for_each_possible_cpu(cpu) {
+		MsgStats *stats = per_cpu_ptr(&msg_stats, cpu);
+		report->total.sent += READ_ONCE(stats->sent);
+		report->total.sentBytes += READ_ONCE(stats->sentBytes);
+		report->total.received += READ_ONCE(stats->received);
+		report->total.receivedBytes += READ_ONCE(stats->receivedBytes);
+		report->total.rejected += READ_ONCE(stats->rejected);
+		report->total.expired += READ_ONCE(stats->expired);
+		report->total.locked += READ_ONCE(stats->locked);
+		report->total.contended += READ_ONCE(stats->contended);
+		for (i = 0; i < LATENCY_BUCKETS; i++) {
+			report->total.latency[i] += READ_ONCE(stats->latency[i]);
+		}
+	}
+	rcu_read_lock();
+	hash_for_each_rcu(mailboxes, bkt, box, hash) {
+		unsigned int count = READ_ONCE(box->count);
+		report->boxes++;
+		report->queued += count;
+		report->pinned += READ_ONCE(box->bytes);
+		report->depth[min_t(unsigned int, fls(count), DEPTH_BUCKETS - 1)]++;
+		// keep the deepest ones sorted, deepest first
+		for (i = TOP_RECIPIENTS - 1; i >= 0 && count > 0 && report->top[i].count < count;
+		     i--) {
+			if (i < TOP_RECIPIENTS - 1) {
+				report->top[i + 1] = report->top[i];
+			}
+			report->top[i].uid = box->uid;
+			report->top[i].count = count;
+			report->top[i].bytes = READ_ONCE(box->bytes);
+		}
+	}
+	rcu_read_unlock();
+}
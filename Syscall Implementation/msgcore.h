@@ -0,0 +1,297 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kernel/msgcore.h
+ *
+ * The message store behind the csc452 message syscalls: identities, payloads,
+ * mailboxes, rings and groups, and the algorithms over them. kernel/sys.c
+ * does the copying from and to userspace and calls in here. The same code
+ * builds as a userspace library against msgcore_user.h for msgbench and
+ * msgfuzz, so none of it may touch userspace memory.
+ */
+#ifndef _KERNEL_MSGCORE_H
+#define _KERNEL_MSGCORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/hashtable.h>
+#include <linux/refcount.h>
+#include <linux/atomic.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/uidgid.h>
+#include <linux/csc452_msg.h>
+#else
+#include "msgcore_user.h"
+#include "csc452_msg.h"
+#endif
+
+// bucket i of the latency histogram counts messages received less than 2^i
+// microseconds after they were sent, the last one everything slower
+#define LATENCY_BUCKETS 24
+// bucket i of the depth histogram counts mailboxes holding less than 2^i
+// messages, the last one everything deeper
+#define DEPTH_BUCKETS 21
+// how many of the deepest mailboxes /proc/csc452_msg lists
+#define TOP_RECIPIENTS 10
+// the timer wheel has WHEEL_SLOTS slots of WHEEL_TICK_MS each, so it turns
+// once a minute and a TTL longer than that waits in its slot for later turns
+#define WHEEL_SLOTS 256
+#define WHEEL_TICK_MS 250
+// blobs wait in one more queue after the priorities, which only
+// csc452_get_blob takes from; TEXT_QUEUES are the bits of the others
+#define BLOB_QUEUE CSC452_PRIO_LEVELS
+#define TEXT_QUEUES ((1UL << CSC452_PRIO_LEVELS) - 1)
+// every mailbox hashes the senders it has messages from into this many bits
+#define PEER_HASH_BITS 4
+
+/**
+ * A sender, kept once no matter how many messages it has queued. Every node
+ * holds a reference; the last one to go frees it. count and bytes are what
+ * the sender has queued over all mailboxes, for its quota.
+ */
+typedef struct Identity {
+	kuid_t uid;
+	struct hlist_node hash;
+	refcount_t refs;
+	atomic_t count;
+	atomic_long_t bytes;
+	struct rcu_head rcu;
+} Identity;
+/**
+ * The bytes of a message. Up to CSC452_INLINE_MAX of them are allocated
+ * inline for their actual length plus the NULL. A blob, anything bigger,
+ * is kept in npages separate pages instead, so the receiver can map them
+ * without another copy. A broadcast queues the same payload in every mailbox
+ * of the group, so every node holds a reference and the last one to go, or
+ * the last blob file, frees it.
+ */
+typedef struct Payload {
+	refcount_t refs;
+	unsigned int len;
+	unsigned int npages;
+	struct page **pages;
+	char data[];
+} Payload;
+/**
+ * The node which is a linked list for message. The recipient is the mailbox
+ * the node sits in, the sender and the text are pointers, so a node is only a
+ * few words and comes from its own slab cache. A message with a TTL is also
+ * linked into its slot of the timer wheel through timer while it is queued.
+ * box is the mailbox it was queued in, so the wheel can take it out of there
+ * and the tracepoints can name its recipient, and id numbers it for them. A
+ * text message is linked through sender into the index of its sender in the
+ * mailbox as well, and holds a reference on that peer.
+ */
+typedef struct Node {
+	struct list_head list;
+	u64 id;
+	Identity *from;
+	Payload *payload;
+	u64 sent;	// ktime_get_ns() when it was sent, for the latency histogram
+	u64 expires;	// ktime_get_ns() when it expires, 0 for never
+	struct list_head timer;
+	struct Mailbox *box;
+	struct Peer *peer;
+	struct list_head sender;
+	unsigned int prio;
+} Node;
+/**
+ * The mailbox of one user. The messages sent to that user are kept in one
+ * FIFO per priority plus the one of blobs, and bit p of nonempty is set while
+ * queue p has messages, so sending adds at the tail of its queue and getting
+ * takes from the head of the first queue with a bit set, both in O(1). Each
+ * mailbox has its own lock, so senders to different users never wait on each
+ * other, and its own wait queue for receivers sleeping until a message comes
+ * in. The text messages are indexed by sender in peers as well, and blobs is
+ * how many of count are blobs. Every node queued there holds a reference
+ * until it is freed, and so do the syscalls using the mailbox, an attached
+ * ring and a notification fd; the last one to go takes the mailbox out of
+ * the hash table and frees it after a grace period, so an empty mailbox
+ * nobody uses does not stay around.
+ */
+typedef struct Mailbox {
+	kuid_t uid;
+	struct hlist_node hash;
+	refcount_t refs;
+	struct rcu_head rcu;
+	spinlock_t lock;
+	struct list_head queues[CSC452_PRIO_LEVELS + 1];
+	unsigned long nonempty;
+	unsigned int count;
+	unsigned int blobs;
+	unsigned long bytes;
+	wait_queue_head_t wait;
+	struct Ring *ring;
+	DECLARE_HASHTABLE(peers, PEER_HASH_BITS);
+} Mailbox;
+/**
+ * The text messages one sender has queued in one mailbox, in one FIFO per
+ * priority again, so a receiver asking only for that sender finds them in
+ * O(1) instead of going over everybody else's. Everything here is under the
+ * lock of the mailbox. Every node of the sender holds a reference, also
+ * while it is taken out, so messages given back find their peer still
+ * there; the last one takes the peer out of the mailbox and frees it.
+ */
+typedef struct Peer {
+	kuid_t uid;
+	struct hlist_node hash;
+	refcount_t refs;
+	Mailbox *box;
+	struct list_head queues[CSC452_PRIO_LEVELS];
+	unsigned long nonempty;
+	unsigned int count;
+} Peer;
+/**
+ * A ring shared with the receiver through /dev/csc452_msg. Senders fill the
+ * slots under the lock of the mailbox and the receiver reads them straight
+ * from its mapping. head and the senders of the slots are the copies of the
+ * kernel, the ones in the shared page are only published, since userspace
+ * can write them. ns is the user namespace the uids in the slots are in.
+ */
+typedef struct Ring {
+	struct csc452_ring *shared;
+	Mailbox *box;
+	u32 head;
+	struct user_namespace *ns;
+	kuid_t from[CSC452_RING_SLOTS];
+} Ring;
+/**
+ * One slot of the timer wheel: the queued messages expiring in a tick that is
+ * the index of the slot modulo WHEEL_SLOTS. Its lock nests inside the lock of
+ * a mailbox.
+ */
+typedef struct WheelSlot {
+	spinlock_t lock;
+	struct list_head nodes;
+} WheelSlot;
+/**
+ * A named group of recipients for broadcasts. The members are kept as uids,
+ * sorted and without duplicates, and their mailboxes are only looked up, or
+ * made, by a broadcast, so a group costs no mailboxes until it is used. A
+ * group is never changed in place: setting it again swaps in a new one, and
+ * broadcasts still holding a reference on the old one finish with it. owner
+ * is the user who made it, the only one besides an admin who may change it.
+ */
+typedef struct Group {
+	char name[CSC452_NAME_MAX];
+	struct hlist_node hash;
+	refcount_t refs;
+	struct rcu_head rcu;
+	kuid_t owner;
+	unsigned int count;
+	kuid_t members[];
+} Group;
+/**
+ * One entry of a vectored send once it is copied in, remembering where it
+ * was in the array so messages to the same mailbox keep their order. status
+ * is 0 once the message is queued or a negative error.
+ */
+typedef struct Pending {
+	Mailbox *box;
+	Node *node;
+	unsigned int index;
+	long status;
+} Pending;
+/**
+ * A message seen by peek_messages() without taking it out: a reference on
+ * its sender and one on its payload, which the caller drops once it copied
+ * them.
+ */
+typedef struct Peek {
+	Identity *from;
+	Payload *payload;
+} Peek;
+/**
+ * The counters of the message store. Each CPU has its own copy, so counting
+ * is never shared between CPUs; reading /proc/csc452_msg adds them up.
+ */
+typedef struct MsgStats {
+	u64 sent;
+	u64 sentBytes;
+	u64 received;
+	u64 receivedBytes;
+	u64 rejected;
+	u64 expired;
+	u64 locked;
+	u64 contended;
+	u64 latency[LATENCY_BUCKETS];
+} MsgStats;
+/**
+ * One of the deepest mailboxes in a MsgReport, copied out since the mailbox
+ * may be gone by the time it is shown.
+ */
+typedef struct TopRecipient {
+	kuid_t uid;
+	unsigned int count;
+	unsigned long bytes;
+} TopRecipient;
+/**
+ * Everything /proc/csc452_msg shows: the counters of every CPU added up and
+ * a snapshot of the mailboxes.
+ */
+typedef struct MsgReport {
+	MsgStats total;
+	u64 depth[DEPTH_BUCKETS];
+	TopRecipient top[TOP_RECIPIENTS];
+	u64 boxes;
+	u64 queued;
+	u64 pinned;
+} MsgReport;
+
+// the limits set through the kernel/csc452 sysctls, 0 means no limit
+extern unsigned int recipient_max_msgs;
+extern unsigned long recipient_max_bytes;
+extern unsigned int sender_max_msgs;
+extern unsigned long sender_max_bytes;
+
+int msgcore_init(void (*armed)(void));
+
+// identities and payloads
+Identity *get_identity(kuid_t uid);
+void put_identity(Identity *id);
+Payload *alloc_payload(unsigned int len);
+Payload *alloc_blob(unsigned int len);
+void put_payload(Payload *payload);
+Node *new_node(Identity *from, Payload *payload, unsigned int prio, unsigned int ttl);
+void free_node(Node *node);
+
+// mailboxes
+Mailbox *find_mailbox(kuid_t uid, bool create);
+void put_mailbox(Mailbox *box);
+long deliver_node(Mailbox *box, Node *node);
+unsigned int deliver_pending(Pending *pending, unsigned int ready, unsigned int flags);
+unsigned int take_messages(Mailbox *box, kuid_t from, struct list_head *batch,
+			   unsigned int max, unsigned int *more);
+long wait_messages(Mailbox *box, kuid_t from, struct list_head *batch, unsigned int max,
+		   unsigned int *more, long timeout);
+unsigned int peek_messages(Mailbox *box, kuid_t from, Peek *peek, unsigned int max,
+			   unsigned int *more);
+unsigned int count_messages(Mailbox *box, kuid_t from);
+long wait_ready(Mailbox *box, kuid_t from, long timeout);
+void return_messages(Mailbox *box, struct list_head *batch);
+long take_blob(Mailbox *box, struct list_head *batch, long timeout);
+bool has_blobs(Mailbox *box);
+void stat_received(Node *node);
+void wake_senders(void);
+u64 mailbox_depth(Mailbox *box);
+unsigned int expire_messages(void);
+bool wheel_pending(void);
+
+// rings
+u32 ring_ready(Ring *ring);
+long attach_ring(Ring *ring, Mailbox *box);
+void detach_ring(Ring *ring);
+long ring_wait(Ring *ring, long timeout);
+
+// groups
+Group *find_group(const char *name, long len);
+void put_group(Group *group);
+long replace_group(const char *name, long len, Group *group, kuid_t uid);
+long broadcast_message(Group *group, Identity *id, Payload *payload, unsigned int prio,
+		       unsigned int ttl);
+
+void collect_stats(MsgReport *report);
+
+#endif /* _KERNEL_MSGCORE_H */
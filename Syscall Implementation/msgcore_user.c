@@ -0,0 +1,167 @@
+/**
+ * File: msgcore_user.c
+ * Author: Quan Nguyen
+ * Project:  Syscalls
+ * Class: CSC252
+ * Purpose: The state behind the userspace stand-ins of msgcore_user.h: the RCU readers and
+ * the frees waiting for them, the per-thread slots used as CPUs, slab caches and the sleeping
+ * half of the wait queues.
+ */
+#include "msgcore_user.h"
+#include <sched.h>
+// a batch of kfree_rcu() calls waits for the readers once
+#define RCU_BATCH 64
+/**
+ * One thread that ever entered an RCU read side section. seq is odd while it is inside.
+ * Readers are never removed, a thread that exited just stays outside.
+ */
+typedef struct Reader {
+    unsigned long seq;
+    struct Reader *next;
+} Reader;
+static Reader *readers;
+static pthread_mutex_t readersLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread Reader *self;
+static __thread int nesting;
+// frees waiting for a grace period
+static struct rcu_head *pending;
+static int pendingCount;
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static int nextCpu;
+static __thread int cpu = -1;
+/**
+ * The slot of the calling thread in per-CPU arrays. Threads past NR_CPUS share slots, which
+ * is why the counters in them are added atomically.
+ */
+int smp_processor_id(void) {
+    if (cpu < 0) {
+        cpu = __atomic_fetch_add(&nextCpu, 1, __ATOMIC_RELAXED) % NR_CPUS;
+    }
+    return cpu;
+}
+struct kmem_cache *kmem_cache_create(size_t size) {
+    struct kmem_cache *cache = malloc(sizeof(*cache));
+    if (cache == NULL) {
+        abort(); // SLAB_PANIC
+    }
+    cache->size = size;
+    return cache;
+}
+/**
+ * Enter a read side section. Only the outermost one is seen by synchronize_rcu().
+ */
+void rcu_read_lock(void) {
+    if (self == NULL) {
+        self = calloc(1, sizeof(Reader));
+        if (self == NULL) {
+            abort();
+        }
+        pthread_mutex_lock(&readersLock);
+        self->next = readers;
+        readers = self;
+        pthread_mutex_unlock(&readersLock);
+    }
+    if (nesting++ == 0) {
+        __atomic_store_n(&self->seq, self->seq + 1, __ATOMIC_RELAXED);
+        // the reads of the section come after the update of seq
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+void rcu_read_unlock(void) {
+    if (--nesting == 0) {
+        __atomic_store_n(&self->seq, self->seq + 1, __ATOMIC_RELEASE);
+    }
+}
+/**
+ * Wait until every reader that was inside a read side section when this was called has left
+ * it. Readers that entered later already see the update, so they are not waited for.
+ */
+void synchronize_rcu(void) {
+    Reader *reader;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&readersLock);
+    for (reader = readers; reader != NULL; reader = reader->next) {
+        unsigned long seq = __atomic_load_n(&reader->seq, __ATOMIC_ACQUIRE);
+        if (reader == self || (seq & 1) == 0) {
+            continue;
+        }
+        while (__atomic_load_n(&reader->seq, __ATOMIC_ACQUIRE) == seq) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&readersLock);
+}
+/**
+ * Free a list of rcu_heads after a grace period.
+ */
+static void free_after_grace(struct rcu_head *head) {
+    synchronize_rcu();
+    while (head != NULL) {
+        struct rcu_head *next = head->next;
+        free(head->ptr);
+        head = next;
+    }
+}
+/**
+ * Free ptr once no reader can see it any more. The frees are kept until RCU_BATCH of them
+ * wait, so the grace period is paid once per batch like call_rcu() in the kernel.
+ */
+void call_rcu_free(struct rcu_head *head, void *ptr) {
+    struct rcu_head *batch = NULL;
+    head->ptr = ptr;
+    pthread_mutex_lock(&pendingLock);
+    head->next = pending;
+    pending = head;
+    if (++pendingCount >= RCU_BATCH) {
+        batch = pending;
+        pending = NULL;
+        pendingCount = 0;
+    }
+    pthread_mutex_unlock(&pendingLock);
+    free_after_grace(batch);
+}
+/**
+ * Free everything kfree_rcu() still holds.
+ */
+void rcu_barrier(void) {
+    struct rcu_head *batch;
+    pthread_mutex_lock(&pendingLock);
+    batch = pending;
+    pending = NULL;
+    pendingCount = 0;
+    pthread_mutex_unlock(&pendingLock);
+    free_after_grace(batch);
+}
+void init_waitqueue_head(wait_queue_head_t *wq) {
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    wq->sleepers = 0;
+}
+void wake_up_interruptible(wait_queue_head_t *wq) {
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+/**
+ * Sleep once on a wait queue whose lock the caller holds, for at most timeout jiffies. Return
+ * how many are left.
+ */
+long wait_sleep(wait_queue_head_t *wq, long timeout) {
+    struct timespec start, end;
+    long elapsed;
+    if (timeout == MAX_SCHEDULE_TIMEOUT) {
+        pthread_cond_wait(&wq->cond, &wq->lock);
+        return timeout;
+    }
+    clock_gettime(CLOCK_REALTIME, &start);
+    end.tv_sec = start.tv_sec + timeout / 1000;
+    end.tv_nsec = start.tv_nsec + timeout % 1000 * 1000000L;
+    if (end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&wq->cond, &wq->lock, &end);
+    clock_gettime(CLOCK_REALTIME, &end);
+    elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    return elapsed >= timeout ? 0 : timeout - elapsed;
+}
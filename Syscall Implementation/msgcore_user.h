@@ -0,0 +1,415 @@
+/**
+ * File: msgcore_user.h
+ * Author: Quan Nguyen
+ * Project:  Syscalls
+ * Class: CSC252
+ * Purpose: The pieces of the kernel API that msgcore.c uses, made out of pthreads and GCC
+ * atomics so the message store builds as a plain userspace library for msgbench and msgfuzz.
+ * Lists, hash tables, refcounts and bit operations behave like the kernel ones. Spinlocks and
+ * mutexes are pthread mutexes, since a userspace lock holder can be preempted. RCU readers
+ * bump a per-thread counter and kfree_rcu() frees in batches once every reader has moved on,
+ * so lookups stay lock free like in the kernel. A wait queue is a mutex and a condition
+ * variable with a count of sleepers, and a jiffy is a millisecond. Per-CPU data is an array
+ * with one slot per thread, and a page is a page aligned allocation. There are no user
+ * namespaces, a kuid_t is the uid itself, and the tracepoints are never on.
+ */
+#ifndef MSGCORE_USER_H
+#define MSGCORE_USER_H
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define __init
+#define __read_mostly
+#define __user
+#define U64_MAX UINT64_MAX
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define div_u64(a, b) ((u64)(a) / (b))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define struct_size(p, member, n) (sizeof(*(p)) + (size_t)(n) * sizeof((p)->member[0]))
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* memory */
+#define GFP_KERNEL 0
+#define SLAB_PANIC 0
+#define kmalloc(size, gfp) malloc(size)
+#define kzalloc(size, gfp) calloc(1, size)
+#define kfree(p) free(p)
+#define kvmalloc(size, gfp) malloc(size)
+#define kvmalloc_array(n, size, gfp) calloc(n, size)
+#define kvfree(p) free(p)
+struct kmem_cache {
+    size_t size;
+};
+struct kmem_cache *kmem_cache_create(size_t size);
+#define KMEM_CACHE(s, flags) kmem_cache_create(sizeof(struct s))
+#define kmem_cache_alloc(cache, gfp) malloc((cache)->size)
+#define kmem_cache_free(cache, p) free(p)
+#define sort(base, num, size, cmp, swap) qsort(base, num, size, cmp)
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define GFP_USER 0
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+struct page;
+#define alloc_page(gfp) ((struct page *)aligned_alloc(PAGE_SIZE, PAGE_SIZE))
+#define page_address(page) ((void *)(page))
+#define __free_page(page) free(page)
+
+/* bit operations */
+static inline unsigned long find_first_bit(const unsigned long *addr, unsigned long size) {
+    unsigned long word = *addr;
+    return word == 0 ? size : min_t(unsigned long, __builtin_ctzl(word), size);
+}
+// not atomic like in the kernel, but lockless readers may READ_ONCE() the word
+static inline void __set_bit(int nr, unsigned long *addr) {
+    WRITE_ONCE(*addr, *addr | 1UL << nr);
+}
+static inline void __clear_bit(int nr, unsigned long *addr) {
+    WRITE_ONCE(*addr, *addr & ~(1UL << nr));
+}
+static inline int test_bit(int nr, const unsigned long *addr) {
+    return (READ_ONCE(*addr) >> nr) & 1;
+}
+static inline int fls(unsigned int x) {
+    return x == 0 ? 0 : 32 - __builtin_clz(x);
+}
+static inline int fls64(u64 x) {
+    return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+/* time, a jiffy is one millisecond */
+#define MAX_SCHEDULE_TIMEOUT LONG_MAX
+#define msecs_to_jiffies(ms) ((long)(ms))
+static inline u64 ktime_get_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* uids, there is only the one user namespace */
+typedef struct {
+    uint32_t val;
+} kuid_t;
+struct user_namespace;
+#define KUIDT_INIT(value) ((kuid_t){ value })
+#define __kuid_val(uid) ((uid).val)
+#define uid_eq(a, b) ((a).val == (b).val)
+#define INVALID_UID KUIDT_INIT((uint32_t)-1)
+#define uid_valid(uid) (!uid_eq(uid, INVALID_UID))
+#define from_kuid_munged(ns, uid) ((uid).val)
+/* nobody is an admin, only owners may change their groups */
+#define CAP_SYS_ADMIN 21
+#define capable(cap) false
+
+/* atomics and reference counts */
+typedef struct {
+    int counter;
+} atomic_t;
+typedef struct {
+    long counter;
+} atomic_long_t;
+typedef atomic_t refcount_t;
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_add(i, v) __atomic_fetch_add(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_inc_return(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec(v) __atomic_fetch_sub(&(v)->counter, 1, __ATOMIC_RELAXED)
+#define atomic_long_read(v) atomic_read(v)
+#define atomic_long_set(v, i) atomic_set(v, i)
+#define atomic_long_add(i, v) atomic_add(i, v)
+#define refcount_set(r, i) atomic_set(r, i)
+#define refcount_read(r) atomic_read(r)
+#define refcount_inc(r) __atomic_fetch_add(&(r)->counter, 1, __ATOMIC_RELAXED)
+#define refcount_dec_and_test(r) (__atomic_sub_fetch(&(r)->counter, 1, __ATOMIC_ACQ_REL) == 0)
+static inline bool refcount_inc_not_zero(refcount_t *r) {
+    int old = __atomic_load_n(&r->counter, __ATOMIC_RELAXED);
+    do {
+        if (old == 0) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&r->counter, &old, old + 1, false, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED));
+    return true;
+}
+
+/* locks */
+typedef pthread_mutex_t spinlock_t;
+#define DEFINE_SPINLOCK(x) spinlock_t x = PTHREAD_MUTEX_INITIALIZER
+#define DEFINE_MUTEX(x) pthread_mutex_t x = PTHREAD_MUTEX_INITIALIZER
+#define spin_lock_init(l) pthread_mutex_init((l), NULL)
+#define spin_lock(l) pthread_mutex_lock(l)
+#define spin_trylock(l) (pthread_mutex_trylock(l) == 0)
+#define spin_unlock(l) pthread_mutex_unlock(l)
+#define mutex_lock(l) pthread_mutex_lock(l)
+#define mutex_unlock(l) pthread_mutex_unlock(l)
+/**
+ * Drop a reference, taking the lock only when it may be the last one. Return true with the
+ * lock held when the count reached 0.
+ */
+static inline bool refcount_dec_and_lock(refcount_t *r, spinlock_t *lock) {
+    int old = __atomic_load_n(&r->counter, __ATOMIC_RELAXED);
+    while (old > 1) {
+        if (__atomic_compare_exchange_n(&r->counter, &old, old - 1, false, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+            return false;
+        }
+    }
+    spin_lock(lock);
+    if (refcount_dec_and_test(r)) {
+        return true;
+    }
+    spin_unlock(lock);
+    return false;
+}
+
+/* per-CPU data, one slot per thread */
+#define NR_CPUS 64
+int smp_processor_id(void);
+#define DEFINE_PER_CPU(type, name) type name[NR_CPUS]
+#define per_cpu_ptr(ptr, cpu) (&(*(ptr))[cpu])
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < NR_CPUS; (cpu)++)
+
+/* RCU */
+struct rcu_head {
+    struct rcu_head *next;
+    void *ptr;
+};
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void synchronize_rcu(void);
+void call_rcu_free(struct rcu_head *head, void *ptr);
+void rcu_barrier(void);
+#define kfree_rcu(p, field) call_rcu_free(&(p)->field, (p))
+#define kvfree_rcu(p, field) call_rcu_free(&(p)->field, (p))
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/* doubly linked lists */
+struct list_head {
+    struct list_head *next, *prev;
+};
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list;
+    list->prev = list;
+}
+static inline void __list_add(struct list_head *entry, struct list_head *prev, struct list_head *next) {
+    next->prev = entry;
+    entry->next = next;
+    entry->prev = prev;
+    prev->next = entry;
+}
+static inline void list_add(struct list_head *entry, struct list_head *head) {
+    __list_add(entry, head, head->next);
+}
+static inline void list_add_tail(struct list_head *entry, struct list_head *head) {
+    __list_add(entry, head->prev, head);
+}
+static inline void list_del(struct list_head *entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+static inline void list_move_tail(struct list_head *entry, struct list_head *head) {
+    list_del(entry);
+    list_add_tail(entry, head);
+}
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+static inline int list_is_singular(const struct list_head *head) {
+    return !list_empty(head) && head->next == head->prev;
+}
+static inline void __list_splice(const struct list_head *list, struct list_head *prev,
+                                 struct list_head *next) {
+    struct list_head *first = list->next, *last = list->prev;
+    first->prev = prev;
+    prev->next = first;
+    last->next = next;
+    next->prev = last;
+}
+static inline void list_splice(const struct list_head *list, struct list_head *head) {
+    if (!list_empty(list)) {
+        __list_splice(list, head, head->next);
+    }
+}
+static inline void list_splice_tail(struct list_head *list, struct list_head *head) {
+    if (!list_empty(list)) {
+        __list_splice(list, head->prev, head);
+    }
+}
+static inline void list_cut_position(struct list_head *list, struct list_head *head,
+                                     struct list_head *entry) {
+    struct list_head *first;
+    if (list_empty(head) || (list_is_singular(head) && head->next != entry && head != entry)) {
+        return;
+    }
+    if (entry == head) {
+        INIT_LIST_HEAD(list);
+        return;
+    }
+    first = entry->next;
+    list->next = head->next;
+    list->next->prev = list;
+    list->prev = entry;
+    entry->next = list;
+    head->next = first;
+    first->prev = head;
+}
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member) list_entry((pos)->member.next, __typeof__(*(pos)), member)
+#define list_prev_entry(pos, member) list_entry((pos)->member.prev, __typeof__(*(pos)), member)
+#define list_for_each(pos, head) for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_safe(pos, n, head) \
+    for (pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+#define list_for_each_entry(pos, head, member)                                      \
+    for (pos = list_first_entry(head, __typeof__(*pos), member); &pos->member != (head); \
+         pos = list_next_entry(pos, member))
+#define list_for_each_entry_safe(pos, n, head, member)                              \
+    for (pos = list_first_entry(head, __typeof__(*pos), member),                    \
+         n = list_next_entry(pos, member); &pos->member != (head);                  \
+         pos = n, n = list_next_entry(n, member))
+#define list_for_each_entry_safe_reverse(pos, n, head, member)                      \
+    for (pos = list_entry((head)->prev, __typeof__(*pos), member),                  \
+         n = list_prev_entry(pos, member); &pos->member != (head);                  \
+         pos = n, n = list_prev_entry(n, member))
+
+/* hash tables of singly linked lists, safe to walk under rcu_read_lock() */
+struct hlist_node {
+    struct hlist_node *next, **pprev;
+};
+struct hlist_head {
+    struct hlist_node *first;
+};
+#define DEFINE_HASHTABLE(name, bits) struct hlist_head name[1 << (bits)]
+#define DECLARE_HASHTABLE(name, bits) struct hlist_head name[1 << (bits)]
+#define hash_init(table) memset(table, 0, sizeof(table))
+#define HASH_SIZE(name) ARRAY_SIZE(name)
+#define HASH_BITS(name) __builtin_ctz(HASH_SIZE(name))
+static inline u32 hash_min(u32 val, unsigned int bits) {
+    return (val * 0x61C88647u) >> (32 - bits);
+}
+static inline void hlist_add_head_rcu(struct hlist_node *n, struct hlist_head *h) {
+    struct hlist_node *first = h->first;
+    n->next = first;
+    n->pprev = &h->first;
+    if (first != NULL) {
+        first->pprev = &n->next;
+    }
+    rcu_assign_pointer(h->first, n);
+}
+static inline void hlist_del_rcu(struct hlist_node *n) {
+    struct hlist_node *next = n->next;
+    WRITE_ONCE(*n->pprev, next);
+    if (next != NULL) {
+        next->pprev = n->pprev;
+    }
+    n->pprev = NULL;
+}
+static inline void hlist_replace_rcu(struct hlist_node *old, struct hlist_node *n) {
+    n->next = old->next;
+    n->pprev = old->pprev;
+    rcu_assign_pointer(*n->pprev, n);
+    if (n->next != NULL) {
+        n->next->pprev = &n->next;
+    }
+    old->pprev = NULL;
+}
+#define hlist_entry_safe(ptr, type, member) \
+    ({ __typeof__(ptr) ____ptr = (ptr); ____ptr ? container_of(____ptr, type, member) : NULL; })
+#define hlist_for_each_entry_rcu(pos, head, member)                                 \
+    for (pos = hlist_entry_safe(rcu_dereference((head)->first), __typeof__(*(pos)), member); \
+         pos; pos = hlist_entry_safe(rcu_dereference((pos)->member.next), __typeof__(*(pos)), member))
+#define hash_add_rcu(table, node, key) hlist_add_head_rcu(node, &(table)[hash_min(key, HASH_BITS(table))])
+#define hash_del_rcu(node) hlist_del_rcu(node)
+#define hash_for_each_possible_rcu(table, obj, member, key) \
+    hlist_for_each_entry_rcu(obj, &(table)[hash_min(key, HASH_BITS(table))], member)
+#define hash_for_each_rcu(table, bkt, obj, member)                                  \
+    for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < (int)HASH_SIZE(table); (bkt)++) \
+        hlist_for_each_entry_rcu(obj, &(table)[bkt], member)
+// under a lock the plain versions are the same
+#define hash_add(table, node, key) hash_add_rcu(table, node, key)
+#define hash_del(node) hash_del_rcu(node)
+#define hash_for_each_possible(table, obj, member, key) \
+    hash_for_each_possible_rcu(table, obj, member, key)
+#define hash_for_each(table, bkt, obj, member) hash_for_each_rcu(table, bkt, obj, member)
+/**
+ * Hash a name of len bytes (FNV-1a), the salt is ignored.
+ */
+static inline unsigned int full_name_hash(const void *salt, const char *name, unsigned int len) {
+    unsigned int hash = 2166136261u, i;
+    (void)salt;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* wait queues */
+typedef struct wait_queue_head {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int sleepers;
+} wait_queue_head_t;
+#define DECLARE_WAIT_QUEUE_HEAD(name) \
+    wait_queue_head_t name = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 }
+void init_waitqueue_head(wait_queue_head_t *wq);
+void wake_up_interruptible(wait_queue_head_t *wq);
+long wait_sleep(wait_queue_head_t *wq, long timeout);
+#define wake_up_interruptible_poll(wq, mask) wake_up_interruptible(wq)
+static inline bool wq_has_sleeper(wait_queue_head_t *wq) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&wq->sleepers, __ATOMIC_RELAXED) > 0;
+}
+/**
+ * Sleep until condition is true or timeout jiffies passed. The condition is checked under the
+ * lock of the wait queue after counting the sleeper, so a waker that changed it and then saw no
+ * sleepers can only have done so before the check. There are no signals, so the result is the
+ * time left (at least 1) when the condition came true and 0 on a timeout.
+ */
+#define wait_event_interruptible_timeout(wq, condition, timeout) ({                  \
+    wait_queue_head_t *__wq = &(wq);                                                \
+    long __ret = (timeout);                                                         \
+    __atomic_fetch_add(&__wq->sleepers, 1, __ATOMIC_SEQ_CST);                       \
+    pthread_mutex_lock(&__wq->lock);                                                \
+    while (!(condition) && __ret > 0) {                                             \
+        __ret = wait_sleep(__wq, __ret);                                            \
+    }                                                                               \
+    if (__ret == 0 && (condition)) {                                                \
+        __ret = 1;                                                                  \
+    }                                                                               \
+    pthread_mutex_unlock(&__wq->lock);                                              \
+    __atomic_fetch_sub(&__wq->sleepers, 1, __ATOMIC_SEQ_CST);                       \
+    __ret; })
+#define wait_event_interruptible(wq, condition) \
+    (wait_event_interruptible_timeout(wq, condition, MAX_SCHEDULE_TIMEOUT), 0)
+
+/* the tracepoints of csc452_trace.h, which are always off here */
+#define trace_csc452_msg_enqueue(box, node) do { } while (0)
+#define trace_csc452_msg_dequeue(node, waited) do { } while (0)
+#define trace_csc452_msg_block(box, remaining, sending) do { } while (0)
+#define trace_csc452_msg_wake(box, slept, ret, sending) do { (void)(slept); } while (0)
+#define trace_csc452_msg_wake_enabled() false
+
+#endif
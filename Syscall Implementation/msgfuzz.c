@@ -0,0 +1,439 @@
+/**
+ * File: msgfuzz.c
+ * Author: Quan Nguyen
+ * Project:  Syscalls
+ * Class: CSC252
+ * Purpose: This is the libFuzzer target of the message store, built in userspace from msgcore.c.
+ * Every input is read as a list of operations on a few users, senders and groups and one ring:
+ * sends, vectored sends, broadcasts, batched gets that sometimes give their messages back,
+ * gets and peeks of only one sender, counting, attaching, reading and closing the ring, changing
+ * the quotas, turning the timer wheel, sending and taking blobs of a few pages, and sending to
+ * users nobody holds on to, whose mailboxes must be gone once they are empty.
+ * Messages get TTLs of a few milliseconds, so some expire on the way. After every operation the
+ * mailboxes are checked against their counters and their index of senders, and at the end of the input everything is
+ * drained, so every message that was queued must have come out or expired and no sender may
+ * still be charged for any. Anything else aborts, and AddressSanitizer catches the rest.
+ * Usage: make fuzz, or msgfuzz [libFuzzer options] [corpus directory]
+ */
+#include "msgcore.h"
+#include <stdio.h>
+#define USERS 4
+#define SENDERS 3
+#define GROUPS 2
+#define STRANGERS 2
+// the uids of the users and the senders; 0 and 65534 are root and nobody
+static const uint32_t users[USERS] = {0, 1000, 1001, 65534};
+static const uint32_t senders[SENDERS] = {0, 1000, 4294967294u};
+static const char *groupNames[GROUPS] = {"all", "two"};
+// users only sent to now and then, nobody keeps a reference on their mailboxes
+static const uint32_t strangers[STRANGERS] = {2000, 2001};
+static Mailbox *boxes[USERS];
+static Ring ring;
+static struct csc452_ring *shared;
+/**
+ * The bytes of the input not read yet. Reading past the end gives 0.
+ */
+typedef struct Input {
+    const uint8_t *data;
+    size_t left;
+} Input;
+uint8_t next(Input *in) {
+    if (in->left == 0) {
+        return 0;
+    }
+    in->left--;
+    return *in->data++;
+}
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);              \
+            abort();                                                                \
+        }                                                                           \
+    } while (0)
+/**
+ * Make a node from user for the message of len bytes taken from the input, with a TTL of up to
+ * 3 milliseconds or none.
+ */
+Node *make_node(Input *in, uint32_t from, unsigned int len, unsigned int prio) {
+    Payload *payload = alloc_payload(len);
+    Identity *id = get_identity(KUIDT_INIT(from));
+    unsigned int i, ttl = next(in) % 8;
+    CHECK(payload != NULL && id != NULL);
+    for (i = 0; i < len; i++) {
+        payload->data[i] = next(in) | 1; // no NULL inside the text
+    }
+    Node *node = new_node(id, payload, prio, ttl < 4 ? ttl : 0);
+    CHECK(node != NULL);
+    return node;
+}
+/**
+ * Make a blob node from user of len bytes, every page filled with its index.
+ */
+Node *make_blob(uint32_t from, unsigned int len, unsigned int ttl) {
+    Payload *payload = alloc_blob(len);
+    Identity *id = get_identity(KUIDT_INIT(from));
+    unsigned int i;
+    CHECK(payload != NULL && id != NULL);
+    CHECK(payload->npages == DIV_ROUND_UP(len, PAGE_SIZE));
+    for (i = 0; i < payload->npages; i++) {
+        memset(page_address(payload->pages[i]), i + 1, i + 1 < payload->npages || len % PAGE_SIZE == 0 ?
+               PAGE_SIZE : len % PAGE_SIZE);
+    }
+    Node *node = new_node(id, payload, 0, ttl);
+    CHECK(node != NULL && node->prio == BLOB_QUEUE);
+    return node;
+}
+/**
+ * Check that a blob has its length, its pages their fill and the end of the last page zeros.
+ */
+void check_blob(Payload *payload) {
+    unsigned int i;
+    CHECK(payload->len > CSC452_INLINE_MAX && payload->npages == DIV_ROUND_UP(payload->len, PAGE_SIZE));
+    for (i = 0; i < PAGE_SIZE * payload->npages; i++) {
+        char byte = ((char *)page_address(payload->pages[i / PAGE_SIZE]))[i % PAGE_SIZE];
+        CHECK(byte == (i < payload->len ? (char)(i / PAGE_SIZE + 1) : 0));
+    }
+}
+/**
+ * How many peers of a mailbox are for uid, where the hash table of the mailbox finds them.
+ */
+unsigned int peers_of(Mailbox *box, kuid_t uid) {
+    unsigned int n = 0;
+    Peer *peer;
+    hash_for_each_possible(box->peers, peer, hash, __kuid_val(uid)) {
+        n += uid_eq(peer->uid, uid);
+    }
+    return n;
+}
+/**
+ * Check that the counters of a mailbox match what is in its queues, and that its peers index
+ * exactly its text messages, each under its sender.
+ */
+void check_mailbox(Mailbox *box) {
+    unsigned long bytes = 0;
+    unsigned int count = 0, blobs = 0, indexed = 0, prio;
+    Node *node;
+    Peer *peer;
+    int bkt;
+    for (prio = 0; prio <= BLOB_QUEUE; prio++) {
+        CHECK(list_empty(&box->queues[prio]) == !(box->nonempty & (1UL << prio)));
+        list_for_each_entry(node, &box->queues[prio], list) {
+            CHECK(node->prio == prio);
+            CHECK(node->box == box && node->id != 0);
+            count++;
+            if (prio == BLOB_QUEUE) {
+                CHECK(node->peer == NULL);
+                blobs++;
+                bytes += sizeof(Node) + sizeof(Payload) +
+                         node->payload->npages * (PAGE_SIZE + sizeof(struct page *));
+                continue;
+            }
+            CHECK(node->peer != NULL && node->peer->box == box);
+            CHECK(uid_eq(node->peer->uid, node->from->uid));
+            CHECK(strlen(node->payload->data) == node->payload->len);
+            bytes += sizeof(Node) + sizeof(Payload) + node->payload->len + 1;
+        }
+    }
+    CHECK(box->count == count);
+    CHECK(box->blobs == blobs);
+    CHECK(box->bytes == bytes);
+    hash_for_each(box->peers, bkt, peer, hash) {
+        unsigned int queued = 0;
+        CHECK(peer->box == box && peers_of(box, peer->uid) == 1);
+        for (prio = 0; prio < CSC452_PRIO_LEVELS; prio++) {
+            CHECK(list_empty(&peer->queues[prio]) == !(peer->nonempty & (1UL << prio)));
+            list_for_each_entry(node, &peer->queues[prio], sender) {
+                CHECK(node->peer == peer && node->prio == prio);
+                queued++;
+            }
+        }
+        CHECK(peer->count == queued);
+        CHECK(refcount_read(&peer->refs) >= (int)queued);
+        indexed += queued;
+    }
+    CHECK(indexed == count - blobs);
+    if (box->ring != NULL) {
+        CHECK(box->ring->head - shared->tail <= CSC452_RING_SLOTS);
+    }
+}
+/**
+ * Free the messages of a batch the way a receiver does, and return how many there were.
+ */
+long receive(struct list_head *batch) {
+    Node *temp, *next;
+    long n = 0;
+    list_for_each_entry_safe(temp, next, batch, list) {
+        list_del(&temp->list);
+        stat_received(temp);
+        free_node(temp);
+        n++;
+    }
+    wake_senders();
+    return n;
+}
+/**
+ * How many messages expired so far, lazily or through the timer wheel.
+ */
+u64 expired_messages(void) {
+    MsgReport report;
+    collect_stats(&report);
+    return report.total.expired;
+}
+/**
+ * Read what the ring holds, up to max messages. Return how many were read.
+ */
+long read_ring(unsigned int max) {
+    unsigned int n = 0;
+    while (n < max && ring_ready(&ring) > 0) {
+        struct csc452_msg *slot = &shared->slot[shared->tail % CSC452_RING_SLOTS];
+        CHECK(strnlen(slot->msg, CSC452_MSG_MAX) == slot->len && slot->len < CSC452_MSG_MAX);
+        CHECK(slot->from == senders[0] || slot->from == senders[1] || slot->from == senders[2]);
+        smp_store_release(&shared->tail, shared->tail + 1);
+        n++;
+    }
+    return n;
+}
+/**
+ * Close the ring if it is open. What it held goes back to the mailbox, so the slots are
+ * dropped like the kernel drops the whole ring.
+ */
+void close_ring(void) {
+    detach_ring(&ring);
+    shared->tail = ring.head;
+}
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    Input in = {data, size};
+    long queued = 0, received = 0;
+    u64 expired;
+    unsigned int i, more;
+    if (shared == NULL) {
+        msgcore_init(NULL);
+        shared = aligned_alloc(64, sizeof(struct csc452_ring));
+        CHECK(shared != NULL);
+        memset(shared, 0, sizeof(*shared));
+        ring.shared = shared;
+        for (i = 0; i < USERS; i++) {
+            boxes[i] = find_mailbox(KUIDT_INIT(users[i]), true);
+        }
+    }
+    expired = expired_messages();
+    recipient_max_msgs = sender_max_msgs = 1 << 20;
+    recipient_max_bytes = sender_max_bytes = 256UL << 20;
+    while (in.left > 0) {
+        uint8_t op = next(&in);
+        Mailbox *box = boxes[next(&in) % USERS];
+        uint32_t from = senders[next(&in) % SENDERS];
+        unsigned int prio = next(&in) % CSC452_PRIO_LEVELS;
+        LIST_HEAD(batch);
+        switch (op % 15) {
+        case 0: { // send
+            unsigned int len = next(&in);
+            if (deliver_node(box, make_node(&in, from, len, prio)) == 0) {
+                queued++;
+            }
+            break;
+        }
+        case 1: { // vectored send
+            Pending pending[8];
+            unsigned int n = next(&in) % 8 + 1;
+            for (i = 0; i < n; i++) {
+                pending[i].box = boxes[next(&in) % USERS];
+                pending[i].node = make_node(&in, from, next(&in) % 16, next(&in) % CSC452_PRIO_LEVELS);
+                pending[i].index = i;
+            }
+            queued += deliver_pending(pending, n, 0);
+            break;
+        }
+        case 2: { // get a batch, maybe of one sender, giving it back when the copy out would fault
+            kuid_t filter = next(&in) & 1 ? KUIDT_INIT(from) : INVALID_UID;
+            Node *node;
+            take_messages(box, filter, &batch, next(&in) % 8 + 1, &more);
+            list_for_each_entry(node, &batch, list) {
+                CHECK(!uid_valid(filter) || uid_eq(node->from->uid, filter));
+            }
+            if (next(&in) & 1) {
+                return_messages(box, &batch);
+            } else {
+                received += receive(&batch);
+            }
+            CHECK(list_empty(&batch));
+            break;
+        }
+        case 3: { // wait without sleeping
+            CHECK(wait_messages(box, INVALID_UID, &batch, next(&in) % 8 + 1, &more, 0) >= 0);
+            received += receive(&batch);
+            break;
+        }
+        case 4: { // set or delete a group
+            uint8_t mask = next(&in);
+            const char *name = groupNames[mask % GROUPS];
+            Group *group = NULL;
+            if (mask >> 4) {
+                group = kvmalloc(struct_size(group, members, USERS * 2), GFP_KERNEL);
+                CHECK(group != NULL);
+                group->count = 0;
+                for (i = 0; i < USERS; i++) {
+                    if (mask & (0x10 << i)) {
+                        // twice, to be merged again
+                        group->members[group->count++] = KUIDT_INIT(users[i]);
+                        group->members[group->count++] = KUIDT_INIT(users[i]);
+                    }
+                }
+            }
+            // only the sender that made a group may change it
+            long err = replace_group(name, strlen(name), group, KUIDT_INIT(from));
+            CHECK(err == 0 || err == -EPERM || (err == -ENOENT && group == NULL));
+            break;
+        }
+        case 5: { // broadcast
+            const char *name = groupNames[next(&in) % GROUPS];
+            Group *group = find_group(name, strlen(name));
+            if (group != NULL) {
+                Node *node = make_node(&in, from, next(&in) % 32, prio);
+                long n = broadcast_message(group, node->from, node->payload, prio, next(&in) % 4);
+                // a group is never empty, so a broadcast queues something or fails
+                CHECK(n != 0 && n <= (long)group->count);
+                if (n > 0) {
+                    queued += n;
+                }
+                put_group(group);
+                free_node(node);
+            }
+            break;
+        }
+        case 6: // attach the ring, which keeps a reference of its own
+            refcount_inc(&box->refs);
+            if (ring.box == NULL) {
+                CHECK(attach_ring(&ring, box) == 0);
+            } else {
+                CHECK(attach_ring(&ring, box) == -EBUSY);
+                put_mailbox(box);
+            }
+            break;
+        case 7: // read the ring, then refill it
+            if (ring.box != NULL) {
+                received += read_ring(next(&in));
+                CHECK(ring_wait(&ring, 0) >= 0);
+            }
+            break;
+        case 8:
+            close_ring();
+            break;
+        case 9: { // quotas, 0 is no limit
+            uint8_t limit = next(&in);
+            recipient_max_msgs = limit & 0xf;
+            sender_max_msgs = limit >> 4;
+            recipient_max_bytes = (unsigned long)next(&in) * 16;
+            break;
+        }
+        case 10:
+            expire_messages();
+            break;
+        case 11: { // send a blob of up to 3 pages
+            unsigned int len = CSC452_INLINE_MAX + 1 + next(&in) * 48;
+            if (deliver_node(box, make_blob(from, len, next(&in) % 4)) == 0) {
+                queued++;
+            }
+            break;
+        }
+        case 12: { // take a blob, giving it back when the fd could not be made
+            long n = take_blob(box, &batch, 0);
+            CHECK(n == 0 || n == 1);
+            CHECK(n == !list_empty(&batch));
+            if (n == 1) {
+                check_blob(list_first_entry(&batch, Node, list)->payload);
+                if (next(&in) & 1) {
+                    return_messages(box, &batch);
+                } else {
+                    received += receive(&batch);
+                }
+            }
+            break;
+        }
+        case 13: { // peek, maybe at one sender, which may only reclaim what expired
+            kuid_t filter = next(&in) & 1 ? KUIDT_INIT(from) : INVALID_UID;
+            unsigned int max = next(&in) % 8 + 1, count = count_messages(box, filter), n;
+            unsigned long bytes = box->bytes;
+            Peek peek[8];
+            n = peek_messages(box, filter, peek, max, &more);
+            CHECK(n <= max && n <= count && (!more || n == max));
+            CHECK(count_messages(box, filter) <= count && box->bytes <= bytes);
+            CHECK(count_messages(box, filter) >= n);
+            for (i = 0; i < n; i++) {
+                CHECK(!uid_valid(filter) || uid_eq(peek[i].from->uid, filter));
+                CHECK(strlen(peek[i].payload->data) == peek[i].payload->len);
+                put_identity(peek[i].from);
+                put_payload(peek[i].payload);
+            }
+            break;
+        }
+        case 14: { // send to a stranger, maybe taking everything back so its mailbox goes away
+            kuid_t uid = KUIDT_INIT(strangers[next(&in) % STRANGERS]);
+            Mailbox *stranger = find_mailbox(uid, true);
+            unsigned int len = next(&in);
+            bool drain = next(&in) & 1;
+            CHECK(stranger != NULL);
+            if (deliver_node(stranger, make_node(&in, from, len, prio)) == 0) {
+                queued++;
+            }
+            check_mailbox(stranger);
+            while (drain && take_messages(stranger, INVALID_UID, &batch, CSC452_BATCH_MAX, &more) > 0) {
+                received += receive(&batch);
+            }
+            put_mailbox(stranger);
+            CHECK(!drain || find_mailbox(uid, false) == NULL);
+            break;
+        }
+        }
+        for (i = 0; i < USERS; i++) {
+            check_mailbox(boxes[i]);
+        }
+    }
+    // drain everything; nothing may be left or lost
+    close_ring();
+    for (i = 0; i < GROUPS; i++) {
+        Group *group = find_group(groupNames[i], strlen(groupNames[i]));
+        if (group != NULL) {
+            kuid_t owner = group->owner;
+            put_group(group);
+            CHECK(replace_group(groupNames[i], strlen(groupNames[i]), NULL, owner) == 0);
+        }
+    }
+    for (i = 0; i < USERS; i++) {
+        LIST_HEAD(batch);
+        while (take_messages(boxes[i], INVALID_UID, &batch, CSC452_BATCH_MAX, &more) > 0) {
+            received += receive(&batch);
+        }
+        while (take_blob(boxes[i], &batch, 0) > 0) {
+            received += receive(&batch);
+        }
+        CHECK(boxes[i]->count == 0 && boxes[i]->bytes == 0 && boxes[i]->nonempty == 0);
+        // the last node of every sender took its peer with it
+        for (int bkt = 0; bkt < (int)HASH_SIZE(boxes[i]->peers); bkt++) {
+            CHECK(boxes[i]->peers[bkt].first == NULL);
+        }
+        // and every node and the ring gave back their references
+        CHECK(refcount_read(&boxes[i]->refs) == 1);
+    }
+    for (i = 0; i < STRANGERS; i++) {
+        LIST_HEAD(batch);
+        Mailbox *stranger = find_mailbox(KUIDT_INIT(strangers[i]), false);
+        if (stranger == NULL) {
+            continue;
+        }
+        while (take_messages(stranger, INVALID_UID, &batch, CSC452_BATCH_MAX, &more) > 0) {
+            received += receive(&batch);
+        }
+        put_mailbox(stranger);
+        // empty and not used, so it is gone
+        CHECK(find_mailbox(KUIDT_INIT(strangers[i]), false) == NULL);
+    }
+    CHECK(queued == received + (long)(expired_messages() - expired));
+    for (i = 0; i < SENDERS; i++) {
+        Identity *id = get_identity(KUIDT_INIT(senders[i]));
+        CHECK(atomic_read(&id->count) == 0 && atomic_long_read(&id->bytes) == 0);
+        put_identity(id);
+    }
+    return 0;
+}
@@ -0,0 +1,250 @@
+/**
+ * File: msgstress.c
+ * Author: Quan Nguyen
+ * Project:  Syscalls
+ * Class: CSC252
+ * Purpose: This is the stress test for the locking of the message syscalls. It forks 1, 2, 4, ...
+ * up to the given number of sender processes, every one sending its share of messages as fast as
+ * it can, and prints the throughput for each count. By default every sender writes to its own
+ * recipient, so with per-mailbox locks the throughput should grow with the number of senders;
+ * with -same they all write to one recipient to show the cost of a shared mailbox. The mailboxes
+ * are drained at the end and the number of messages read back is checked. Mailboxes belong to uids
+ * and only a uid can read its own, so the recipients are the uids from STRESS_UID up, drained by
+ * children that switch to them, which needs root; -same uses the mailbox of the caller instead.
+ * Every sender runs as the caller, so the largest round is checked against the message quotas
+ * in /proc/sys/kernel/csc452 before anything is sent.
+ * Usage: msgstress [maxSenders] [messagesPerSender] [-same]
+ */
+#include "csc452_msg.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+// the uid of the recipient of sender 0, sender i sends to STRESS_UID + i
+#define STRESS_UID 60000
+/**
+ * Make the function of syscall of sending message more readable.
+ */
+int send_msg(__u32 to, char *msg) {
+    return syscall(443, to, msg, CSC452_PRIO_DEFAULT, CSC452_TTL_NONE);
+}
+/**
+ * Make the function of syscall of getting message more readable.
+ */
+int get_msg(char *msg, __u32 *from) {
+    return syscall(444, msg, from);
+}
+/**
+ * Get the time right now in seconds.
+ */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/**
+ * Uid of the recipient used by sender number i.
+ */
+__u32 recipient(int i, int same) {
+    return same ? getuid() : (__u32)(STRESS_UID + i);
+}
+/**
+ * Read one of the quotas in /proc/sys/kernel/csc452. Returns 0, which is no limit, when it
+ * cannot be read.
+ */
+unsigned long read_quota(const char *name) {
+    char path[128];
+    unsigned long value = 0;
+    snprintf(path, sizeof(path), "/proc/sys/kernel/csc452/%s", name);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fscanf(f, "%lu", &value) != 1) {
+        value = 0;
+    }
+    fclose(f);
+    return value;
+}
+/**
+ * Check before the first round that the largest one stays under the message quotas. All
+ * the senders run as the caller, so the kernel charges every message of a round to one
+ * sender; with -same they also all land in one mailbox. Return 0 when it fits, or print
+ * the quota in the way and return -1.
+ */
+int fits_quotas(int senders, long count, int same) {
+    unsigned long total = (unsigned long)senders * count;
+    unsigned long perSender = read_quota("sender_max_msgs");
+    unsigned long perRecipient = read_quota("recipient_max_msgs");
+    unsigned long inOneBox = same ? total : (unsigned long)count;
+    if (perSender != 0 && total > perSender) {
+        printf("%d senders x %ld messages is %lu messages from one uid, over sender_max_msgs (%lu)\n",
+               senders, count, total, perSender);
+    } else if (perRecipient != 0 && inOneBox > perRecipient) {
+        printf("%lu messages to one mailbox is over recipient_max_msgs (%lu)\n", inOneBox, perRecipient);
+    } else {
+        return 0;
+    }
+    printf("Send fewer messages or raise the quota in /proc/sys/kernel/csc452\n");
+    return -1;
+}
+/**
+ * Run one round with the given number of senders. Every child waits on the pipe so they
+ * all start at the same time. Return the time the round took in seconds, -1 on failure,
+ * or -2 when a sender hit a message quota of the kernel.
+ */
+double run_round(int senders, long count, int same) {
+    int go[2], i, status, failed = 0, quota = 0;
+    if (pipe(go) < 0) {
+        return -1;
+    }
+    for (i = 0; i < senders; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            return -1;
+        }
+        if (pid == 0) {
+            __u32 to = recipient(i, same);
+            char msg[64], c;
+            long n;
+            close(go[1]);
+            read(go[0], &c, 1); // returns when the parent closes the pipe
+            for (n = 0; n < count; n++) {
+                snprintf(msg, sizeof(msg), "message %ld from sender %d", n, i);
+                if (send_msg(to, msg) != 0) {
+                    _exit(errno == EAGAIN ? 2 : 1);
+                }
+            }
+            _exit(0);
+        }
+    }
+    close(go[0]);
+    double start = now();
+    close(go[1]);
+    for (i = 0; i < senders; i++) {
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+            quota |= WIFEXITED(status) && WEXITSTATUS(status) == 2;
+        }
+    }
+    double elapsed = now() - start;
+    return quota ? -2 : failed ? -1 : elapsed;
+}
+/**
+ * Drain the mailbox of the caller and return how many messages were in it.
+ */
+long drain_own() {
+    char msg[CSC452_MSG_MAX];
+    __u32 from;
+    long total = 0;
+    while (get_msg(msg, &from) == 1) {
+        total++;
+    }
+    return total;
+}
+/**
+ * Drain the mailbox of uid in a child that switches to it, and return how many messages
+ * were in it or -1 when the child could not.
+ */
+long drain_as(__u32 uid) {
+    int out[2], status;
+    long total = -1;
+    if (pipe(out) < 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        close(out[0]);
+        if (setuid(uid) != 0) {
+            _exit(1);
+        }
+        total = drain_own();
+        write(out[1], &total, sizeof(total));
+        _exit(0);
+    }
+    close(out[1]);
+    if (read(out[0], &total, sizeof(total)) != sizeof(total)) {
+        total = -1;
+    }
+    close(out[0]);
+    waitpid(pid, &status, 0);
+    return total;
+}
+/**
+ * Drain the mailboxes used by the round and return how many messages were in them.
+ */
+long drain(int senders, int same) {
+    long total = 0, got;
+    int i;
+    if (same) {
+        return drain_own();
+    }
+    for (i = 0; i < senders; i++) {
+        got = drain_as(recipient(i, same));
+        if (got < 0) {
+            return -1;
+        }
+        total += got;
+    }
+    return total;
+}
+/**
+ * Main function for handling argument and print out the result.
+ */
+int main(int argc, char *argv[]) {
+    int maxSenders = 8, same = 0, senders, i, positional = 0;
+    long count = 100000;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-same") == 0) {
+            same = 1;
+        } else if (positional == 0) {
+            maxSenders = atoi(argv[i]);
+            positional++;
+        } else {
+            count = atol(argv[i]);
+        }
+    }
+    if (maxSenders < 1 || count < 1) {
+        printf("Usage: msgstress [maxSenders] [messagesPerSender] [-same]\n");
+        return -1;
+    }
+    if (!same && geteuid() != 0) {
+        printf("One recipient per sender needs root to read their mailboxes, or use -same\n");
+        return -1;
+    }
+    int largest = 1;
+    while (largest * 2 <= maxSenders) {
+        largest *= 2;
+    }
+    if (fits_quotas(largest, count, same) != 0) {
+        return -1;
+    }
+    double base = 0;
+    printf("senders  messages/s    speedup\n");
+    for (senders = 1; senders <= maxSenders; senders *= 2) {
+        double elapsed = run_round(senders, count, same);
+        long got = drain(senders, same);
+        if (elapsed == -2) {
+            printf("%7d  hit the message quota, see /proc/sys/kernel/csc452\n", senders);
+            return -1;
+        }
+        if (elapsed < 0 || got != senders * count) {
+            printf("%7d  failed (%ld of %ld messages came back)\n", senders, got, senders * count);
+            return -1;
+        }
+        double rate = senders * count / elapsed;
+        if (senders == 1) {
+            base = rate;
+        }
+        printf("%7d  %10.0f  %8.2fx\n", senders, rate, rate / base);
+    }
+    return 0;
+}
@@ -4,70 +4,725 @@
  * Project:  Syscalls
  * Class: CSC252 
  * Purpose: This is the main interaction program for passing small text messages from one user 
- * to another by way of the kernel by ultilizing the newly implemented two syscall in the sys.c 
+ * to another by way of the kernel by ultilizing the newly implemented syscalls in the sys.c 
  * file. 
  */ 
+#include "csc452_msg.h"
 #include<stdio.h>
 #include<string.h>
 #include<stdlib.h>
+#include <errno.h>
 #include <sys/syscall.h>     
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <time.h>
+#include <pwd.h>
+// how many users the name cache remembers
+#define USER_CACHE 64
 /**
- * Make the function of syscall of sending message more readable. 
+ * A user name and its uid, as looked up in the password database.
  */
-int send_msg(char *to, char *msg, char *from) {
-    return syscall(443, to, msg, from);
+typedef struct CachedUser {
+    char name[CSC452_NAME_MAX];
+    __u32 uid;
+} CachedUser;
+// the users looked up so far, so a stream or a long receive asks the password
+// database once per user instead of once per message
+static CachedUser userCache[USER_CACHE];
+static int cachedUsers;
+/**
+ * Remember a user in the cache. Once it is full the oldest one makes room.
+ */
+void cache_user(const char *name, __u32 uid) {
+    CachedUser *entry = &userCache[cachedUsers++ % USER_CACHE];
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    entry->uid = uid;
+}
+/**
+ * Find the uid of a user name, or take a number as the uid itself. Return 0, or -1
+ * when there is no such user.
+ */
+int resolve_user(const char *name, __u32 *uid) {
+    struct passwd *pw;
+    char *end;
+    int i;
+    for (i = 0; i < cachedUsers && i < USER_CACHE; i++) {
+        if (strcmp(userCache[i].name, name) == 0) {
+            *uid = userCache[i].uid;
+            return 0;
+        }
+    }
+    unsigned long number = strtoul(name, &end, 10);
+    if (*name != '\0' && *end == '\0' && number <= 0xffffffffUL) {
+        *uid = number;
+        return 0;
+    }
+    pw = getpwnam(name);
+    if (pw == NULL) {
+        return -1;
+    }
+    *uid = pw->pw_uid;
+    cache_user(name, *uid);
+    return 0;
+}
+/**
+ * Find the name of a uid to print, or the number when it has none. The name stays
+ * valid until the cache makes room for another user.
+ */
+const char *user_name(__u32 uid) {
+    static char number[16];
+    struct passwd *pw;
+    int i;
+    for (i = 0; i < cachedUsers && i < USER_CACHE; i++) {
+        if (userCache[i].uid == uid) {
+            return userCache[i].name;
+        }
+    }
+    pw = getpwuid(uid);
+    if (pw == NULL || strlen(pw->pw_name) >= CSC452_NAME_MAX) {
+        snprintf(number, sizeof(number), "%u", uid);
+        return number;
+    }
+    cache_user(pw->pw_name, uid);
+    return userCache[(cachedUsers - 1) % USER_CACHE].name;
+}
+/**
+ * Make the function of syscall of sending message more readable. The message goes to
+ * the uid to and the kernel takes the sender from the caller. prio is from 0 (the
+ * most urgent) to CSC452_PRIO_LEVELS - 1, and a message nobody got within ttl
+ * milliseconds is dropped (never when ttl is CSC452_TTL_NONE).
+ */
+int send_msg(__u32 to, char *msg, unsigned int prio, unsigned int ttl) {
+    return syscall(443, to, msg, prio, ttl);
+}
+/**
+ * Make the function of syscall of getting one message more readable. It comes from
+ * the mailbox of the caller and from gets the uid of the sender. Return 1 when there
+ * was one, 0 when the mailbox is empty.
+ */
+int get_msg(char *msg, __u32 *from) {
+    return syscall(444, msg, from);
+}
+/**
+ * Make the function of syscall of getting many messages at once more readable. 
+ * Return how many messages were put in msgs, status tells if there are more. 
+ * With CSC452_WAIT in flags it sleeps until a message comes, for at most timeout 
+ * milliseconds (forever when negative). With CSC452_FROM only the messages of the 
+ * uid from are got, CSC452_PEEK leaves them in the mailbox and CSC452_COUNT only 
+ * returns how many there are. 
+ */
+int get_msgs(struct csc452_msg *msgs, unsigned int max, unsigned int *status,
+             unsigned int flags, long timeout, __u32 from) {
+    return syscall(445, msgs, max, status, flags, timeout, from);
+}
+/**
+ * Make the function of syscall of sending many messages at once more readable. The
+ * status of every message is written back into descs. Return how many were queued.
+ */
+int send_msgs(struct csc452_send *descs, unsigned int count, unsigned int flags) {
+    return syscall(446, descs, count, flags);
+}
+/**
+ * Make the function of syscall of the notification fd of the caller's mailbox more
+ * readable.
+ */
+int msg_fd(unsigned int flags) {
+    return syscall(447, flags);
+}
+/**
+ * Make the function of syscall of setting a group more readable. members holds count
+ * user names or uids.
+ */
+int set_group(char *group, char **members, unsigned int count) {
+    __u32 *uids = malloc((count + 1) * sizeof(__u32));
+    unsigned int i;
+    int ret;
+    if (uids == NULL) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (resolve_user(members[i], &uids[i]) < 0) {
+            printf("No such user %s\n", members[i]);
+            free(uids);
+            return -1;
+        }
+    }
+    ret = syscall(448, group, uids, count);
+    free(uids);
+    return ret;
 }
 /**
- * Make the function of syscall of getting message more readable. 
+ * Make the function of syscall of broadcasting to a group more readable. Return how
+ * many members got the message.
  */
-int get_msg(char *to, char *msg, char *from) {
-    return syscall(444, to, msg, from);
+int broadcast(char *group, char *msg, unsigned int prio, unsigned int ttl) {
+    return syscall(449, group, msg, prio, ttl);
+}
+/**
+ * Make the function of syscall of sending len bytes of anything to the uid to more
+ * readable. Up to CSC452_INLINE_MAX bytes go like a message, more make a blob.
+ */
+int send_data(__u32 to, const void *data, size_t len, unsigned int prio, unsigned int ttl) {
+    return syscall(450, to, data, len, prio, ttl);
+}
+/**
+ * Make the function of syscall of taking the oldest blob of the caller more readable.
+ * Return a read only fd of the blob, whose sender and length are put in info.
+ */
+int get_blob(struct csc452_blob *info, unsigned int flags, long timeout) {
+    return syscall(451, info, flags, timeout);
+}
+/**
+ * Receive through the ring of /dev/csc452_msg instead of the syscalls. Every message
+ * that is in the ring is read straight from the mapping; only an empty ring costs a
+ * syscall, which sleeps for at most timeout milliseconds. Return when a wait ends
+ * with nothing new. Unread messages go back to the mailbox when the file is closed.
+ */
+int ring_receive(long timeout) {
+    int fd = open("/dev/csc452_msg", O_RDWR);
+    if (fd < 0 || ioctl(fd, CSC452_RING_ATTACH) < 0) {
+        printf("Could not attach the ring\n");
+        return -1;
+    }
+    struct csc452_ring *ring = mmap(NULL, sizeof(struct csc452_ring), PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        printf("Could not map the ring\n");
+        close(fd);
+        return -1;
+    }
+    unsigned int tail = ring->tail;
+    do {
+        while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+            struct csc452_msg *slot = &ring->slot[tail % CSC452_RING_SLOTS];
+            printf("%s said: %s\n", user_name(slot->from), slot->msg);
+            // give the slot back only once it is read
+            __atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+        }
+    } while (ioctl(fd, CSC452_RING_WAIT, timeout) > 0);
+    munmap(ring, sizeof(struct csc452_ring));
+    close(fd);
+    return 0;
+}
+/**
+ * Send the file at path to the uid to with one syscall. The file is mapped rather
+ * than read, so the kernel copies it straight from the page cache into the blob.
+ */
+int send_file(__u32 to, const char *path, unsigned int prio, unsigned int ttl) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0 || st.st_size > CSC452_BLOB_MAX) {
+        printf("Could not read %s, or it is empty or over %d bytes\n", path, CSC452_BLOB_MAX);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Could not map %s\n", path);
+        return -1;
+    }
+    int ret = send_data(to, data, st.st_size, prio, ttl);
+    munmap(data, st.st_size);
+    if (ret == 0) {
+        printf("Sent %lld bytes\n", (long long)st.st_size);
+        return 0;
+    }
+    printf(errno == EAGAIN ? "Send failed, the mailbox or your quota is full\n" : "Send failed\n");
+    return -1;
+}
+/**
+ * Take the oldest blob of the caller, waiting for at most timeout milliseconds, and
+ * write it to stdout straight from its mapping. Who sent it and how big it is goes to
+ * stderr, so stdout can be redirected into a file.
+ */
+int receive_blob(long timeout) {
+    struct csc452_blob info;
+    int fd = get_blob(&info, CSC452_WAIT | CSC452_BLOB_CLOEXEC, timeout);
+    if (fd < 0) {
+        printf(errno == EAGAIN ? "No blob\n" : "Receive failed\n");
+        return -1;
+    }
+    char *data = mmap(NULL, info.len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Could not map the blob\n");
+        return -1;
+    }
+    fprintf(stderr, "%s sent %llu bytes\n", user_name(info.from), (unsigned long long)info.len);
+    size_t done = 0;
+    while (done < info.len) {
+        ssize_t n = write(STDOUT_FILENO, data + done, info.len - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    munmap(data, info.len);
+    return done == info.len ? 0 : -1;
+}
+/**
+ * Get the time right now in nanoseconds. Every process reads the same clock, so a
+ * time written into a message by the sender can be compared by the receiver.
+ */
+unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/**
+ * Order latencies for the percentiles.
+ */
+int compare_latency(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+/**
+ * One bench sender: send count messages of size bytes to the uid to with syscall
+ * 443, each starting with the time it was sent. With a rate it sends one message
+ * every 1/rate seconds, otherwise as fast as it can; a full quota makes it try the
+ * same message again and counts it in retries.
+ */
+void bench_sender(__u32 to, long count, int size, long rate, long *retries) {
+    char msg[CSC452_MSG_MAX];
+    unsigned long long start = now_ns();
+    long n;
+    memset(msg, 'x', size);
+    msg[size] = '\0';
+    for (n = 0; n < count; n++) {
+        if (rate > 0) {
+            unsigned long long due = start + n * 1000000000ULL / rate;
+            struct timespec ts = {due / 1000000000ULL, due % 1000000000ULL};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        for (;;) {
+            // the stamp and its space are at most 21 characters, then the padding
+            int len = snprintf(msg, size + 1, "%llu ", now_ns());
+            if (len < size) {
+                msg[len] = 'x';
+            }
+            if (send_msg(to, msg, CSC452_PRIO_DEFAULT, CSC452_TTL_NONE) == 0) {
+                break;
+            }
+            if (errno != EAGAIN) {
+                _exit(1);
+            }
+            __atomic_fetch_add(retries, 1, __ATOMIC_RELAXED);
+            sched_yield();
+        }
+    }
+    _exit(0);
+}
+/**
+ * One bench receiver: take messages from the mailbox of the caller with syscall 444
+ * until all total of them came in, and write how long each one took from the send
+ * into the next free entry of latency, in nanoseconds. The receivers share the
+ * mailbox and the count of entries written in received. The syscall does not
+ * sleep, so an empty mailbox only yields the CPU.
+ */
+void bench_receiver(long total, unsigned long long *latency, long *received) {
+    char msg[CSC452_MSG_MAX];
+    __u32 from;
+    while (__atomic_load_n(received, __ATOMIC_RELAXED) < total) {
+        int got = get_msg(msg, &from);
+        if (got < 0) {
+            _exit(1);
+        }
+        if (got == 0) {
+            sched_yield();
+            continue;
+        }
+        unsigned long long sent = strtoull(msg, NULL, 10);
+        latency[__atomic_fetch_add(received, 1, __ATOMIC_RELAXED)] = now_ns() - sent;
+    }
+    _exit(0);
+}
+/**
+ * The load generator. Fork senders sender processes and receivers receiver
+ * processes, every sender sending count messages of size bytes to the caller's own
+ * uid, at rate messages per second each (0 for as fast as it can), and the receivers
+ * sharing its mailbox. The receivers write the latencies into memory shared with
+ * the parent, which prints the throughput and the 50th, 99th and 99.9th percentile
+ * of the end to end latency. The mailbox has to be empty to start with, so no real
+ * message is taken for one of the bench.
+ */
+int bench(int senders, int receivers, long count, int size, long rate) {
+    long total = senders * count, *retries, *received;
+    size_t shared = total * sizeof(unsigned long long) + 2 * sizeof(long);
+    unsigned long long *latency, depth;
+    int go[2], i, status, failed = 0;
+    int fd = msg_fd(CSC452_FD_NONBLOCK);
+    if (fd < 0) {
+        printf("Could not check the mailbox\n");
+        return -1;
+    }
+    if (read(fd, &depth, sizeof(depth)) == sizeof(depth)) {
+        printf("Your mailbox holds %llu message(s), receive them before the bench\n", depth);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    latency = mmap(NULL, shared, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (latency == MAP_FAILED || pipe(go) < 0) {
+        printf("Could not set up the bench\n");
+        return -1;
+    }
+    retries = (long *)(latency + total);
+    received = retries + 1;
+    for (i = 0; i < senders + receivers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf("Could not fork\n");
+            return -1;
+        }
+        if (pid == 0) {
+            char c;
+            close(go[1]);
+            read(go[0], &c, 1); // returns when the parent closes the pipe
+            if (i < senders) {
+                bench_sender(getuid(), count, size, rate, retries);
+            }
+            bench_receiver(total, latency, received);
+        }
+    }
+    close(go[0]);
+    unsigned long long start = now_ns();
+    close(go[1]);
+    for (i = 0; i < senders + receivers; i++) {
+        wait(&status);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    if (failed) {
+        printf("A bench process failed\n");
+        return -1;
+    }
+    qsort(latency, total, sizeof(*latency), compare_latency);
+    printf("%d senders, %d receivers, %ld messages of %d bytes\n", senders, receivers, total, size);
+    printf("throughput %.0f messages/s, %.2f MB/s over %.3f s\n", total / elapsed,
+           total * (double)size / elapsed / 1e6, elapsed);
+    printf("latency p50 %.1f us, p99 %.1f us, p999 %.1f us\n", latency[total / 2] / 1e3,
+           latency[(long)(total * 0.99)] / 1e3, latency[(long)(total * 0.999)] / 1e3);
+    printf("retries on a full quota %ld\n", *retries);
+    munmap(latency, shared);
+    return 0;
+}
+// bytes osmsg -s user - reads from stdin at a time
+#define STREAM_BUFFER (1 << 20)
+/**
+ * Send the batch of messages in descs, count them in sent and failed, and empty it.
+ */
+void flush_batch(struct csc452_send *descs, unsigned int *count, long *sent, long *failed) {
+    unsigned int i;
+    if (*count == 0) {
+        return;
+    }
+    if (send_msgs(descs, *count, CSC452_WAIT) < 0) {
+        *failed += *count;
+    } else {
+        for (i = 0; i < *count; i++) {
+            if (descs[i].status == 0) {
+                (*sent)++;
+            } else {
+                (*failed)++;
+            }
+        }
+    }
+    *count = 0;
+}
+/**
+ * Send every message read from stdin to the uid to, one per line or, when delim is
+ * '\0', one per NULL terminated string. stdin is read in blocks of STREAM_BUFFER
+ * bytes and the messages point straight into the block, which is sent with one
+ * syscall for up to CSC452_BATCH_MAX of them before it is read over. A full quota
+ * makes the syscall wait instead of dropping messages. A message longer than the
+ * block is cut like the kernel cuts it. Print how many were sent at the end.
+ */
+int stream_send(__u32 to, unsigned int prio, unsigned int ttl, char delim) {
+    char *buf = malloc(STREAM_BUFFER);
+    struct csc452_send *descs = malloc(CSC452_BATCH_MAX * sizeof(struct csc452_send));
+    unsigned int count = 0;
+    long sent = 0, failed = 0;
+    size_t used = 0;
+    ssize_t got;
+    int skipping = 0, eof = 0;
+    if (buf == NULL || descs == NULL) {
+        printf("Out of memory\n");
+        return -1;
+    }
+    unsigned long long start = now_ns();
+    while (!eof) {
+        got = read(STDIN_FILENO, buf + used, STREAM_BUFFER - used);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            printf("Reading stdin failed\n");
+            break;
+        }
+        eof = got == 0;
+        used += got;
+        char *line = buf, *end = buf + used, *stop;
+        for (;;) {
+            stop = memchr(line, delim, end - line);
+            if (stop == NULL) {
+                if ((eof && line < end) || (line == buf && used == STREAM_BUFFER)) {
+                    stop = end; // the last message, or one longer than the whole block
+                } else {
+                    break;
+                }
+            }
+            if (!skipping) {
+                struct csc452_send *desc = &descs[count++];
+                desc->msg = (__u64)(unsigned long)line;
+                desc->to = to;
+                desc->len = stop - line;
+                desc->prio = prio;
+                desc->ttl = ttl;
+                desc->reserved = 0;
+                if (count == CSC452_BATCH_MAX) {
+                    flush_batch(descs, &count, &sent, &failed);
+                }
+            }
+            // the rest of a message that was too long for the block is dropped
+            skipping = stop == end && !eof;
+            line = stop == end ? end : stop + 1;
+        }
+        // the messages point into the block, so they go before it is read over
+        flush_batch(descs, &count, &sent, &failed);
+        used = end - line;
+        memmove(buf, line, used);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    printf("Sent %ld message(s) to %s in %.3f s", sent, user_name(to), elapsed);
+    if (failed > 0) {
+        printf(", %ld failed", failed);
+    }
+    printf("\n");
+    free(buf);
+    free(descs);
+    return failed > 0 ? -1 : 0;
+}
+/**
+ * Receive from the mailbox of the uid running this and print what came, from the uid 
+ * from only with CSC452_FROM in flags. The messages are taken in batches, one syscall 
+ * for up to CSC452_BATCH_MAX of them, until the mailbox is empty; only the first call 
+ * waits with CSC452_WAIT. With CSC452_PEEK one batch is printed and left where it is, 
+ * and with CSC452_COUNT only how many there are. 
+ */
+int receive(unsigned int flags, long timeout, __u32 from) {
+    unsigned int status = CSC452_MORE;
+    int i, count;
+    if (flags & CSC452_COUNT) {
+        count = get_msgs(NULL, 0, &status, flags, timeout, from);
+        if (count < 0) {
+            printf("Count failed\n");
+            return -1;
+        }
+        printf("%d message(s)%s%s\n", count, flags & CSC452_FROM ? " from " : "",
+               flags & CSC452_FROM ? user_name(from) : "");
+        return 0;
+    }
+    struct csc452_msg *msgs = malloc(CSC452_BATCH_MAX * sizeof(struct csc452_msg));
+    if (msgs == NULL) {
+        printf("Out of memory\n");
+        return -1;
+    }
+    while (status & CSC452_MORE) { // there are message to be read
+        count = get_msgs(msgs, CSC452_BATCH_MAX, &status, flags, timeout, from);
+        flags &= ~CSC452_WAIT; // only the first call waits, then drain what is there
+        if (count < 0) {
+            printf("Receive failed\n");
+            free(msgs);
+            return -1;
+        }
+        for (i = 0; i < count; i++) {
+            printf("%s said: %s\n", user_name(msgs[i].from), msgs[i].msg);
+        }
+        if (flags & CSC452_PEEK) {
+            // the same messages would come again
+            if (status & CSC452_MORE) {
+                printf("and more after these\n");
+            }
+            break;
+        }
+    }
+    if (status & CSC452_BLOBS) {
+        printf("There are blobs waiting too, take them with osmsg -B\n");
+    }
+    free(msgs);
+    return 0;
 }
 /**
  *  Main function for handling arugment and print out the result. 
- *  The way that the program will be called is osmsg -s [userTo] [message] for sending, and 
- *  osmsg -r for receiving.  
+ *  The way that the program will be called is osmsg -s [userTo] [message] [prio] [ttlMs] 
+ *  for sending (prio 0 is the most urgent, CSC452_PRIO_DEFAULT when left out; a message 
+ *  nobody got within ttlMs is dropped, none by default), 
+ *  osmsg -r [userFrom] for receiving, everything or only what userFrom sent, and 
+ *  osmsg -w [timeoutMs] for receiving that sleeps until at least one message is there 
+ *  (or the timeout ends). osmsg -p [userFrom] shows the messages without taking them 
+ *  and osmsg -c [userFrom] only counts them. osmsg -m [timeoutMs] receives 
+ *  through the mapped ring until no message came for timeoutMs (0 by default).  
+ *  osmsg -g [group] [user]... sets the members of a group (none deletes it), and 
+ *  osmsg -b [group] [message] [prio] [ttlMs] sends one message to all of them.  
+ *  osmsg -s [userTo] - [prio] [-t ttlMs] [-0] sends every line of stdin as a message, 
+ *  or every NULL terminated string with -0, in batches, and prints a summary.  
+ *  osmsg -f [userTo] [file] [prio] [ttlMs] sends a whole file of up to CSC452_BLOB_MAX 
+ *  bytes, and osmsg -B [timeoutMs] writes the oldest one sent to you to stdout.  
+ *  osmsg bench [-s senders] [-r receivers] [-n messagesPerSender] [-b bytes] 
+ *  [-R messagesPerSecond] runs the load generator on your own mailbox.  
+ *  A user is a user name or a uid; the sender is always the uid running osmsg and 
+ *  the receiving modes read its own mailbox.  
  */ 
 int main (int argc, char *argv[]) {
-    if (!(argc == 2 || argc==4)) {
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        int senders = 4, receivers = 4, size = 64, i;
+        long count = 10000, rate = 0;
+        for (i = 2; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "-s") == 0) {
+                senders = atoi(argv[i + 1]);
+            } else if (strcmp(argv[i], "-r") == 0) {
+                receivers = atoi(argv[i + 1]);
+            } else if (strcmp(argv[i], "-n") == 0) {
+                count = atol(argv[i + 1]);
+            } else if (strcmp(argv[i], "-b") == 0) {
+                size = atoi(argv[i + 1]);
+            } else if (strcmp(argv[i], "-R") == 0) {
+                rate = atol(argv[i + 1]);
+            } else {
+                break;
+            }
+        }
+        // the size has to hold the time stamp
+        if (i < argc || senders < 1 || receivers < 1 || count < 1 || rate < 0 || size < 21 ||
+            size >= CSC452_MSG_MAX) {
+            printf("Usage: osmsg bench [-s senders] [-r receivers] [-n messagesPerSender] "
+                   "[-b bytes (21 to %d)] [-R messagesPerSecond]\n", CSC452_MSG_MAX - 1);
+            return -1;
+        }
+        return bench(senders, receivers, count, size, rate);
+    }
+    if (argc >= 3 && strcmp(argv[1], "-g") == 0) {
+        if (set_group(argv[2], argv + 3, argc - 3) != 0) {
+            printf("Setting the group failed\n");
+            return -1;
+        }
+        printf("Group %s set\n", argv[2]);
+        return 0;
+    }
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "-b") == 0) {
+        int count = broadcast(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : CSC452_PRIO_DEFAULT,
+                              argc == 6 ? atoi(argv[5]) : CSC452_TTL_NONE);
+        if (count < 0) {
+            printf("Broadcast failed\n");
+            return -1;
+        }
+        printf("Sent to %d member(s)\n", count);
+        return 0;
+    }
+    if (argc >= 4 && argc <= 8 && strcmp(argv[1], "-s") == 0 && strcmp(argv[3], "-") == 0) {
+        unsigned int prio = CSC452_PRIO_DEFAULT, ttl = CSC452_TTL_NONE;
+        char delim = '\n';
+        __u32 to;
+        int i;
+        for (i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "-0") == 0) {
+                delim = '\0';
+            } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                ttl = atoi(argv[++i]);
+            } else {
+                prio = atoi(argv[i]);
+            }
+        }
+        if (resolve_user(argv[2], &to) < 0) {
+            printf("No such user %s\n", argv[2]);
+            return -1;
+        }
+        return stream_send(to, prio, ttl, delim);
+    }
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "-f") == 0) {
+        __u32 to;
+        if (resolve_user(argv[2], &to) < 0) {
+            printf("No such user %s\n", argv[2]);
+            return -1;
+        }
+        return send_file(to, argv[3], argc >= 5 ? atoi(argv[4]) : CSC452_PRIO_DEFAULT,
+                         argc == 6 ? atoi(argv[5]) : CSC452_TTL_NONE);
+    }
+    if (argc <= 3 && argc >= 2 && strcmp(argv[1], "-B") == 0) {
+        return receive_blob(argc == 3 ? atol(argv[2]) : -1);
+    }
+    if ((argc == 2 || argc == 3) && (strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "-c") == 0 ||
+                                     (argc == 3 && strcmp(argv[1], "-r") == 0))) {
+        unsigned int flags = argv[1][1] == 'p' ? CSC452_PEEK : argv[1][1] == 'c' ? CSC452_COUNT : 0;
+        __u32 from = 0;
+        if (argc == 3) {
+            if (resolve_user(argv[2], &from) < 0) {
+                printf("No such user %s\n", argv[2]);
+                return -1;
+            }
+            flags |= CSC452_FROM;
+        }
+        return receive(flags, -1, from);
+    }
+    if (argc < 2 || argc > 6) {
         printf("Please have correct number of argument(s), the current count is %d\n", argc);
         return -1; 
     } 
-    if (argc == 2) {
-        if (strcmp(argv[1], "-r") != 0) {
+    unsigned int flags = 0;
+    long timeout = -1;
+    if (argc == 2 || argc == 3) {
+        if (strcmp(argv[1], "-w") == 0 || strcmp(argv[1], "-m") == 0) {
+            flags = CSC452_WAIT;
+            if (argc == 3) {
+                timeout = atol(argv[2]);
+            } else if (strcmp(argv[1], "-m") == 0) {
+                timeout = 0;
+            }
+        } else if (argc == 3 || strcmp(argv[1], "-r") != 0) {
             printf("Invalid commands\n");
             return -1;
         }
-    } else { // argc == 3 for sending
+    } else { // argc == 4, 5 or 6 for sending
         if (strcmp(argv[1], "-s") != 0) {
             printf("Invalid commands\n");
             return -1;
         }
     }
-    char user[33]; 
-    strcpy(user, getenv("USER"));
     // handling sending message here
     if (strcmp(argv[1], "-s") == 0) {
-        // the user here is the one sending the message (thus from)
+        // the kernel takes the sender from the uid running this
         // again, the instruction is osmsg -s [userTo] [message]
-        if (send_msg(argv[2], argv[3], user) == 0) {
+        unsigned int prio = argc >= 5 ? atoi(argv[4]) : CSC452_PRIO_DEFAULT;
+        unsigned int ttl = argc == 6 ? atoi(argv[5]) : CSC452_TTL_NONE;
+        __u32 to;
+        if (resolve_user(argv[2], &to) < 0) {
+            printf("No such user %s\n", argv[2]);
+            return -1;
+        }
+        if (send_msg(to, argv[3], prio, ttl) == 0) {
             printf("Send successful\n"); 
             return 0; 
+        } else if (errno == EAGAIN) {
+            printf("Send failed, the mailbox or your quota is full\n"); 
+            return -1;
         } else {
             printf("Send failed\n"); 
             return -1;
         }
-    } else { //strcmp(argv[1], "-r") == 0
-        // in here, the user is the one who requesting the message (thus to)
-        // the instruction is osmsg -r 
-        char from[33]; 
-        char msg[1024];
-        while (get_msg(user, msg, from) == 1) { // there are message to be read
-            printf("%s said: %s\n", from, msg);
-        }
-        
-        return 0; 
+    } else if (strcmp(argv[1], "-m") == 0) {
+        return ring_receive(timeout);
+    } else { // -r or -w
+        // in here, the messages come from the mailbox of the uid running this
+        // the instruction is osmsg -r or osmsg -w [timeoutMs]
+        return receive(flags, timeout, 0);
     }
     // shouldn't come here at all 
     return -1; 
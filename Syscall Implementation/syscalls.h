@@ -69,6 +69,9 @@ struct io_uring_params;
 struct clone_args;
 struct open_how;
 struct mount_attr;
+struct csc452_msg;
+struct csc452_send;
+struct csc452_blob;
 
 #include <linux/types.h>
 #include <linux/aio_abi.h>
@@ -732,8 +735,23 @@ asmlinkage long sys_rt_sigtimedwait_time32(const sigset_t __user *uthese,
 asmlinkage long sys_rt_sigqueueinfo(pid_t pid, int sig, siginfo_t __user *uinfo);
 
 /* kernel/sys.c */
-asmlinkage long sys_csc452_send_msg(const char __user *to, const char __user *msg, const char __user *from);
-asmlinkage long sys_csc452_get_msg(const char __user *to, char __user *msg, char __user *from);
+asmlinkage long sys_csc452_send_msg(__u32 to, const char __user *msg, unsigned int prio,
+				unsigned int ttl);
+asmlinkage long sys_csc452_get_msg(char __user *msg, __u32 __user *from);
+asmlinkage long sys_csc452_get_msgs(struct csc452_msg __user *msgs, unsigned int max,
+				unsigned int __user *status, unsigned int flags, long timeout,
+				__u32 from);
+asmlinkage long sys_csc452_send_msgs(struct csc452_send __user *descs, unsigned int count,
+				unsigned int flags);
+asmlinkage long sys_csc452_msg_fd(unsigned int flags);
+asmlinkage long sys_csc452_set_group(const char __user *name, const __u32 __user *members,
+				unsigned int count);
+asmlinkage long sys_csc452_broadcast(const char __user *name, const char __user *msg,
+				unsigned int prio, unsigned int ttl);
+asmlinkage long sys_csc452_send_data(__u32 to, const void __user *data, size_t len,
+				unsigned int prio, unsigned int ttl);
+asmlinkage long sys_csc452_get_blob(struct csc452_blob __user *info, unsigned int flags,
+				long timeout);
 asmlinkage long sys_setpriority(int which, int who, int niceval);
 asmlinkage long sys_getpriority(int which, int who);
 asmlinkage long sys_reboot(int magic1, int magic2, unsigned int cmd,
@@ -868,8 +868,22 @@ __SYSCALL(__NR_mount_setattr, sys_mount_setattr)
 __SYSCALL(__NR_csc452_send_msg, sys_csc452_send_msg)
 #define __NR_csc452_get_msg 444
 __SYSCALL(__NR_csc452_get_msg, sys_csc452_get_msg)
+#define __NR_csc452_get_msgs 445
+__SYSCALL(__NR_csc452_get_msgs, sys_csc452_get_msgs)
+#define __NR_csc452_send_msgs 446
+__SYSCALL(__NR_csc452_send_msgs, sys_csc452_send_msgs)
+#define __NR_csc452_msg_fd 447
+__SYSCALL(__NR_csc452_msg_fd, sys_csc452_msg_fd)
+#define __NR_csc452_set_group 448
+__SYSCALL(__NR_csc452_set_group, sys_csc452_set_group)
+#define __NR_csc452_broadcast 449
+__SYSCALL(__NR_csc452_broadcast, sys_csc452_broadcast)
+#define __NR_csc452_send_data 450
+__SYSCALL(__NR_csc452_send_data, sys_csc452_send_data)
+#define __NR_csc452_get_blob 451
+__SYSCALL(__NR_csc452_get_blob, sys_csc452_get_blob)
 #undef __NR_syscalls
-#define __NR_syscalls 445
+#define __NR_syscalls 452
 
 /*
  * 32 bit systems traditionally used different